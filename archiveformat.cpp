@@ -0,0 +1,172 @@
+#include "archiveformat.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Huffman {
+    namespace {
+        const size_t MAX_VARINT_SIZE = 10;
+        const size_t MAX_STRING_SIZE = 1 << 16;
+    }
+
+    size_t VarintSize(uint64_t value) {
+        size_t size = 1;
+        for (; value >= 0x80; value >>= 7) {
+            ++size;
+        }
+        return size;
+    }
+
+    ByteWriter::ByteWriter(std::ostream& out, uint64_t offset) {
+        out_ = &out;
+        memory_out_ = nullptr;
+        capacity_ = 0;
+        offset_ = offset;
+    }
+
+    ByteWriter::ByteWriter(char* data, size_t capacity) {
+        out_ = nullptr;
+        memory_out_ = data;
+        capacity_ = capacity;
+        offset_ = 0;
+    }
+
+    void ByteWriter::WriteByte(uint8_t value) {
+        char byte = static_cast<char>(value);
+        WriteBytes(&byte, 1);
+    }
+
+    void ByteWriter::WriteVarint(uint64_t value) {
+        while (value >= 0x80) {
+            WriteByte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        WriteByte(static_cast<uint8_t>(value));
+    }
+
+    void ByteWriter::WriteVarint(uint64_t value, size_t width) {
+        if (width < VarintSize(value)) {
+            throw std::runtime_error("ByteWriter: Varint is wider than its field.");
+        }
+        for (size_t i = 1; i < width; ++i) {
+            WriteByte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        WriteByte(static_cast<uint8_t>(value));
+    }
+
+    void ByteWriter::WriteUint64(uint64_t value) {
+        for (size_t i = 0; i < sizeof(value); ++i) {
+            WriteByte(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void ByteWriter::WriteString(const std::string& value) {
+        WriteVarint(value.size());
+        WriteBytes(value.data(), value.size());
+    }
+
+    void ByteWriter::WriteBytes(const char* data, size_t size) {
+        if (out_ != nullptr) {
+            out_->write(data, size);
+        } else {
+            if (size > capacity_ - offset_) {
+                throw std::runtime_error("ByteWriter: Output buffer is too small.");
+            }
+            std::copy(data, data + size, memory_out_ + offset_);
+        }
+        offset_ += size;
+    }
+
+    uint64_t ByteWriter::Offset() const {
+        return offset_;
+    }
+
+    ByteReader::ByteReader(std::istream& in, uint64_t offset) {
+        in_ = &in;
+        memory_in_ = nullptr;
+        size_ = 0;
+        offset_ = offset;
+    }
+
+    ByteReader::ByteReader(const char* data, size_t size) {
+        in_ = nullptr;
+        memory_in_ = data;
+        size_ = size;
+        offset_ = 0;
+    }
+
+    uint8_t ByteReader::ReadByte() {
+        char value;
+        if (in_ == nullptr) {
+            ReadBytes(&value, 1);
+            return static_cast<uint8_t>(value);
+        }
+        if (!in_->get(value)) {
+            throw std::runtime_error("ByteReader: Unexpected end of archive.");
+        }
+        ++offset_;
+        return static_cast<uint8_t>(value);
+    }
+
+    uint64_t ByteReader::ReadVarint() {
+        uint64_t value = 0;
+        for (size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+            uint8_t byte = ReadByte();
+            value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("ByteReader: Malformed integer in archive.");
+    }
+
+    uint64_t ByteReader::ReadUint64() {
+        uint64_t value = 0;
+        for (size_t i = 0; i < sizeof(value); ++i) {
+            value |= static_cast<uint64_t>(ReadByte()) << (8 * i);
+        }
+        return value;
+    }
+
+    std::string ByteReader::ReadString() {
+        uint64_t size = ReadVarint();
+        if (size > MAX_STRING_SIZE) {
+            throw std::runtime_error("ByteReader: Malformed string in archive.");
+        }
+        std::string value(size, '\0');
+        ReadBytes(value.data(), size);
+        return value;
+    }
+
+    void ByteReader::ReadBytes(char* data, size_t size) {
+        if (in_ != nullptr) {
+            in_->read(data, size);
+            if (static_cast<size_t>(in_->gcount()) != size) {
+                throw std::runtime_error("ByteReader: Unexpected end of archive.");
+            }
+        } else {
+            if (size > size_ - offset_) {
+                throw std::runtime_error("ByteReader: Unexpected end of archive.");
+            }
+            std::copy(memory_in_ + offset_, memory_in_ + offset_ + size, data);
+        }
+        offset_ += size;
+    }
+
+    void ByteReader::SkipBytes(size_t size) {
+        if (in_ != nullptr) {
+            in_->ignore(size);
+            if (static_cast<size_t>(in_->gcount()) != size) {
+                throw std::runtime_error("ByteReader: Unexpected end of archive.");
+            }
+        } else if (size > size_ - offset_) {
+            throw std::runtime_error("ByteReader: Unexpected end of archive.");
+        }
+        offset_ += size;
+    }
+
+    uint64_t ByteReader::Offset() const {
+        return offset_;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Archive layout since format version 2 (all integers are LEB128 varints unless noted):
+//   header:  ARCHIVE_MAGIC, u8 FORMAT_VERSION
+//   member:  u8 RECORD_MEMBER, name length, name bytes; followed by the member's blocks
+//   block:   u8 RECORD_BLOCK, u8 block type, raw size, payload bit count, payload bytes
+//   table:   u8 RECORD_TABLE, payload bit count, code lengths (see WriteCodeLengths); a code table for
+//            the HUFFMAN_SHARED blocks of all members after it, written once by solid archives
+//   duplicate: u8 RECORD_DUPLICATE, name length, name bytes, offset of the RECORD_MEMBER of an earlier
+//            member with the same contents; a member stored this way has no blocks of its own
+//   index:   u8 RECORD_INDEX, member count, and for every member: name, raw size, offset of its
+//            RECORD_MEMBER or RECORD_DUPLICATE, packed size (bytes from that offset to the member's last
+//            block), offset of its code table (0 when every block carries its own table)
+//   trailer: u64 little-endian offset of RECORD_INDEX, INDEX_MAGIC
+// Block payloads are LSB-first bit streams padded to a whole byte. Version 1 archives (a single bit
+// stream with in-band FILENAME_END/ONE_MORE_FILE/ARCHIVE_END symbols) have no header; their first
+// nine bits hold a symbol count of at most SYMBOLS_COUNT, which ARCHIVE_MAGIC can never match.
+namespace Huffman {
+    const char ARCHIVE_MAGIC[] = { '\xFF', '\xFF', 'H', 'F' };
+    const size_t ARCHIVE_MAGIC_SIZE = sizeof(ARCHIVE_MAGIC);
+    const uint8_t FORMAT_VERSION = 2;
+
+    const char INDEX_MAGIC[] = { 'H', 'F', 'I', 'X' };
+    const size_t TRAILER_SIZE = sizeof(uint64_t) + sizeof(INDEX_MAGIC);
+
+    const uint8_t RECORD_INDEX = 0;
+    const uint8_t RECORD_MEMBER = 1;
+    const uint8_t RECORD_BLOCK = 2;
+    const uint8_t RECORD_TABLE = 3;
+    const uint8_t RECORD_DUPLICATE = 4;
+
+    const size_t BLOCK_SIZE = 1 << 20;
+
+    struct MemberInfo {
+        std::string name;
+        uint64_t size;
+        uint64_t offset;
+        uint64_t packed_size;
+        uint64_t table_offset;
+    };
+
+    // Bytes ByteWriter::WriteVarint takes for value.
+    size_t VarintSize(uint64_t value);
+
+    // Byte-level archive writer that keeps track of the current offset in the archive. The memory variant
+    // writes into a caller's buffer of capacity bytes and throws once it is full.
+    class ByteWriter {
+    public:
+        // offset is the archive offset out is positioned at.
+        explicit ByteWriter(std::ostream& out, uint64_t offset = 0);
+        explicit ByteWriter(char* data, size_t capacity);
+
+        void WriteByte(uint8_t value);
+        void WriteVarint(uint64_t value);
+        // Writes value in exactly width bytes, padding it with continuation bytes; ByteReader reads it as
+        // any other varint. width must be at least VarintSize(value).
+        void WriteVarint(uint64_t value, size_t width);
+        void WriteUint64(uint64_t value);
+        void WriteString(const std::string& value);
+        void WriteBytes(const char* data, size_t size);
+        uint64_t Offset() const;
+
+    private:
+        std::ostream* out_;
+        char* memory_out_;
+        size_t capacity_;
+        uint64_t offset_;
+    };
+
+    // Byte-level archive reader; offset is the archive offset the stream is positioned at.
+    class ByteReader {
+    public:
+        explicit ByteReader(std::istream& in, uint64_t offset = 0);
+        explicit ByteReader(const char* data, size_t size);
+
+        uint8_t ReadByte();
+        uint64_t ReadVarint();
+        uint64_t ReadUint64();
+        std::string ReadString();
+        void ReadBytes(char* data, size_t size);
+        void SkipBytes(size_t size);
+        uint64_t Offset() const;
+
+    private:
+        std::istream* in_;
+        const char* memory_in_;
+        size_t size_;
+        uint64_t offset_;
+    };
+}
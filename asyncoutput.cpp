@@ -0,0 +1,86 @@
+#include "asyncoutput.h"
+
+namespace Huffman {
+    AsyncOutputBuffer::AsyncOutputBuffer(std::streambuf* target) {
+        target_ = target;
+        chunk_count_ = 1;
+        writing_ = false;
+        failed_ = false;
+        stopping_ = false;
+        current_.resize(ASYNC_CHUNK_SIZE);
+        setp(current_.data(), current_.data() + current_.size());
+        writer_ = std::thread([this]() { WriterLoop(); });
+    }
+
+    AsyncOutputBuffer::~AsyncOutputBuffer() {
+        sync();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+        writer_.join();
+    }
+
+    AsyncOutputBuffer::int_type AsyncOutputBuffer::overflow(int_type ch) {
+        SwapChunk();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int AsyncOutputBuffer::sync() {
+        if (pptr() > pbase()) {
+            SwapChunk();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this]() { return full_chunks_.empty() && !writing_; });
+        if (!failed_ && target_->pubsync() != 0) {
+            failed_ = true;
+        }
+        return failed_ ? -1 : 0;
+    }
+
+    void AsyncOutputBuffer::SwapChunk() {
+        current_.resize(pptr() - pbase());
+        std::unique_lock<std::mutex> lock(mutex_);
+        full_chunks_.push(std::move(current_));
+        if (free_chunks_.empty() && chunk_count_ < ASYNC_CHUNK_COUNT) {
+            ++chunk_count_;
+            free_chunks_.emplace_back();
+        }
+        condition_.notify_all();
+        condition_.wait(lock, [this]() { return !free_chunks_.empty(); });
+        current_ = std::move(free_chunks_.back());
+        free_chunks_.pop_back();
+        lock.unlock();
+        current_.resize(ASYNC_CHUNK_SIZE);
+        setp(current_.data(), current_.data() + current_.size());
+    }
+
+    void AsyncOutputBuffer::WriterLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            condition_.wait(lock, [this]() { return stopping_ || !full_chunks_.empty(); });
+            if (full_chunks_.empty()) {
+                return;
+            }
+            std::vector<char> chunk = std::move(full_chunks_.front());
+            full_chunks_.pop();
+            writing_ = true;
+            bool failed = failed_;
+            lock.unlock();
+            // After a failure the rest is dropped; the chunks still go back to the free list.
+            if (!failed && target_->sputn(chunk.data(), chunk.size()) != static_cast<std::streamsize>(chunk.size())) {
+                failed = true;
+            }
+            lock.lock();
+            failed_ = failed_ || failed;
+            writing_ = false;
+            free_chunks_.push_back(std::move(chunk));
+            condition_.notify_all();
+        }
+    }
+}
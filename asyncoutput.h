@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <queue>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+namespace Huffman {
+    const size_t ASYNC_CHUNK_SIZE = 1 << 20;
+    const size_t ASYNC_CHUNK_COUNT = 4;
+
+    // Stream buffer that hands every full chunk of ASYNC_CHUNK_SIZE bytes to a writer thread, which writes
+    // it to target while the caller fills the next one. At most ASYNC_CHUNK_COUNT chunks exist and are
+    // reused; the caller waits for a free one when the writer falls behind. A failed write makes every
+    // later sync() fail.
+    class AsyncOutputBuffer : public std::streambuf {
+    public:
+        explicit AsyncOutputBuffer(std::streambuf* target);
+        // Writes what is left; errors are lost unless sync() was called before.
+        ~AsyncOutputBuffer() override;
+
+        AsyncOutputBuffer(const AsyncOutputBuffer&) = delete;
+        AsyncOutputBuffer& operator=(const AsyncOutputBuffer&) = delete;
+
+    protected:
+        int_type overflow(int_type ch) override;
+        int sync() override;
+
+    private:
+        std::streambuf* target_;
+        std::vector<char> current_;
+        std::queue<std::vector<char>> full_chunks_;
+        std::vector<std::vector<char>> free_chunks_;
+        size_t chunk_count_;
+        bool writing_;
+        bool failed_;
+        bool stopping_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        std::thread writer_;
+
+        // Queues the filled part of current_ and makes a free chunk current.
+        void SwapChunk();
+        void WriterLoop();
+    };
+}
@@ -0,0 +1,376 @@
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "archiveformat.h"
+#include "bitstream.h"
+#include "block.h"
+#include "coder.h"
+#include "histogram.h"
+#include "huffmantree.h"
+
+// Throughput benchmark of the archiver components over a synthetic corpus generated from fixed seeds,
+// so that results are comparable between builds. All measurements run on one thread. Every dataset is
+// generated and measured in a child process of its own, so that its memory use is not hidden by the
+// high-water mark of the datasets before it.
+namespace {
+    const double MIN_MEASURE_SECONDS = 0.25;
+    const size_t MEGABYTE = 1 << 20;
+
+    const char* const DATASET_NAMES[] = { "random", "text", "skewed", "tiny_files", "huge" };
+    const size_t DATASET_COUNT = sizeof(DATASET_NAMES) / sizeof(DATASET_NAMES[0]);
+
+    struct Dataset {
+        const char* name;
+        std::vector<std::string> files;
+    };
+
+    // Trivially copyable, so that a child process can hand it back through a pipe.
+    struct Result {
+        const char* name;
+        size_t file_count;
+        size_t raw_size;
+        size_t archive_size;
+        double histogram_mbps;
+        double tree_mbps;
+        double bit_write_mbps;
+        double bit_read_mbps;
+        double encode_mbps;
+        double decode_mbps;
+        double archive_encode_mbps;
+        double archive_decode_mbps;
+        // Growth of the peak resident set over that with just the dataset in memory.
+        long rss_growth_kb;
+    };
+
+    // Discards everything written to it.
+    class NullBuffer : public std::streambuf {
+    protected:
+        int overflow(int c) override {
+            return c;
+        }
+
+        std::streamsize xsputn(const char*, std::streamsize count) override {
+            return count;
+        }
+    };
+
+    std::string RandomBytes(size_t size, std::mt19937_64& random) {
+        std::string data(size, '\0');
+        for (auto& byte : data) {
+            byte = static_cast<char>(random());
+        }
+        return data;
+    }
+
+    // Words of 2-9 letters drawn with a Zipf-like skew, with punctuation and line breaks.
+    std::string TextLike(size_t size, std::mt19937_64& random) {
+        std::vector<std::string> words(2000);
+        for (auto& word : words) {
+            size_t length = 2 + random() % 8;
+            for (size_t i = 0; i < length; ++i) {
+                word += static_cast<char>('a' + random() % 26);
+            }
+        }
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::string data;
+        data.reserve(size + 16);
+        size_t words_in_line = 0;
+        while (data.size() < size) {
+            double u = uniform(random);
+            data += words[static_cast<size_t>(words.size() * u * u * u)];
+            if (++words_in_line == 12) {
+                data += ".\n";
+                words_in_line = 0;
+            } else {
+                data += ' ';
+            }
+        }
+        data.resize(size);
+        return data;
+    }
+
+    // Low-entropy bytes with geometrically distributed values.
+    std::string Skewed(size_t size, std::mt19937_64& random) {
+        std::geometric_distribution<int> geometric(0.3);
+        std::string data(size, '\0');
+        for (auto& byte : data) {
+            byte = static_cast<char>(std::min(geometric(random), 255));
+        }
+        return data;
+    }
+
+    // Every dataset has a seed of its own, so it does not depend on which datasets are generated before it.
+    Dataset MakeDataset(size_t index, size_t size) {
+        std::mt19937_64 random(20240601 + index);
+        Dataset dataset = { DATASET_NAMES[index], {} };
+        if (index == 0) {
+            dataset.files.push_back(RandomBytes(size, random));
+        } else if (index == 1) {
+            dataset.files.push_back(TextLike(size, random));
+        } else if (index == 2) {
+            dataset.files.push_back(Skewed(size, random));
+        } else if (index == 3) {
+            for (size_t total = 0; total < size / 2;) {
+                dataset.files.push_back(TextLike(64 + random() % 2048, random));
+                total += dataset.files.back().size();
+            }
+        } else {
+            dataset.files.push_back(TextLike(8 * size, random));
+        }
+        return dataset;
+    }
+
+    template <typename Function>
+    double MeasureThroughput(size_t bytes, Function function) {
+        auto start = std::chrono::steady_clock::now();
+        size_t runs = 0;
+        double elapsed = 0;
+        do {
+            function();
+            ++runs;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed < MIN_MEASURE_SECONDS);
+        return static_cast<double>(bytes) * runs / elapsed / MEGABYTE;
+    }
+
+    long PeakRssKb() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    Result RunDataset(const Dataset& dataset) {
+        struct Block {
+            const unsigned char* data;
+            size_t size;
+        };
+        std::vector<Block> blocks;
+        size_t raw_size = 0;
+        for (const auto& file : dataset.files) {
+            const auto* data = reinterpret_cast<const unsigned char*>(file.data());
+            for (size_t offset = 0; offset < file.size(); offset += Huffman::BLOCK_SIZE) {
+                blocks.push_back({ data + offset, std::min(Huffman::BLOCK_SIZE, file.size() - offset) });
+            }
+            raw_size += file.size();
+        }
+
+        Result result = { dataset.name, dataset.files.size(), raw_size, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        std::vector<std::vector<size_t>> histograms;
+        result.histogram_mbps = MeasureThroughput(raw_size, [&]() {
+            histograms.clear();
+            for (const auto& block : blocks) {
+                histograms.push_back(Huffman::CountBytes(block.data, block.size));
+            }
+        });
+        result.tree_mbps = MeasureThroughput(raw_size, [&]() {
+            for (const auto& histogram : histograms) {
+                Huffman::HuffmanTree::GetEncodedChars(histogram);
+            }
+        });
+
+        // The bit streams alone: the codes of every block written one by one with a BitWriter and read back
+        // with BitReader::Read, which peeks and skips, taking their lengths from the table instead of decoding.
+        std::vector<Huffman::HuffmanTree::CodeTable> tables;
+        for (const auto& histogram : histograms) {
+            tables.push_back(Huffman::HuffmanTree::GetEncodedChars(histogram));
+        }
+        std::vector<std::vector<char>> streams(blocks.size());
+        result.bit_write_mbps = MeasureThroughput(raw_size, [&]() {
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                streams[i].clear();
+                BitWriter writer(streams[i]);
+                for (size_t j = 0; j < blocks[i].size; ++j) {
+                    const auto& encoded_char = tables[i][blocks[i].data[j]];
+                    writer.Write(encoded_char.code, encoded_char.codelen);
+                }
+            }
+        });
+        result.bit_read_mbps = MeasureThroughput(raw_size, [&]() {
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                BitReader reader(streams[i].data(), streams[i].size());
+                for (size_t j = 0; j < blocks[i].size; ++j) {
+                    const auto& encoded_char = tables[i][blocks[i].data[j]];
+                    if (reader.Read(encoded_char.codelen) != encoded_char.code) {
+                        throw std::runtime_error("Bench: Bit stream mismatch in " + std::string(dataset.name) + ".");
+                    }
+                }
+            }
+        });
+
+        std::vector<Huffman::EncodedBlock> encoded;
+        result.encode_mbps = MeasureThroughput(raw_size, [&]() {
+            encoded.clear();
+            for (const auto& block : blocks) {
+                encoded.push_back(Huffman::EncodeBlock(block.data, block.size));
+            }
+        });
+        std::vector<unsigned char> decoded(Huffman::BLOCK_SIZE);
+        result.decode_mbps = MeasureThroughput(raw_size, [&]() {
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                Huffman::DecodeBlock(encoded[i], decoded.data());
+                if (std::memcmp(decoded.data(), blocks[i].data, blocks[i].size) != 0) {
+                    throw std::runtime_error("Bench: Block round trip mismatch in " + std::string(dataset.name) + ".");
+                }
+            }
+        });
+
+        std::string archive;
+        result.archive_encode_mbps = MeasureThroughput(raw_size, [&]() {
+            std::ostringstream out;
+            {
+                Huffman::Encoder encoder(out);
+                for (size_t i = 0; i < dataset.files.size(); ++i) {
+                    std::istringstream in(dataset.files[i]);
+                    encoder.EncodeStream(in, std::to_string(i));
+                }
+            }
+            archive = out.str();
+        });
+        result.archive_size = archive.size();
+        result.archive_decode_mbps = MeasureThroughput(raw_size, [&]() {
+            std::istringstream in(archive);
+            NullBuffer null_buffer;
+            std::ostream out(&null_buffer);
+            Huffman::Decoder decoder(in);
+            decoder.DecodeStream(out);
+        });
+        return result;
+    }
+
+    // Generates and measures one dataset in a child process.
+    Result RunDatasetInChild(size_t index, size_t size) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::runtime_error("Bench: Cannot create a pipe.");
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("Bench: Cannot start a child process.");
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            try {
+                Dataset dataset = MakeDataset(index, size);
+                long baseline_kb = PeakRssKb();
+                Result result = RunDataset(dataset);
+                result.rss_growth_kb = PeakRssKb() - baseline_kb;
+                _exit(write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+            } catch (const std::exception& e) {
+                std::cerr << "Error!" << std::endl << e.what() << std::endl;
+                _exit(1);
+            }
+        }
+        close(fds[1]);
+        Result result;
+        ssize_t read_count = read(fds[0], &result, sizeof(result));
+        close(fds[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        if (read_count != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error("Bench: Dataset " + std::string(DATASET_NAMES[index]) + " failed.");
+        }
+        return result;
+    }
+
+    void PrintText(const std::vector<Result>& results) {
+        std::cout << std::left << std::setw(12) << "dataset" << std::right << std::setw(8) << "files" << std::setw(10) << "MiB"
+                  << std::setw(8) << "ratio" << std::setw(11) << "histogram" << std::setw(9) << "tree" << std::setw(9) << "bit.wr"
+                  << std::setw(9) << "bit.rd" << std::setw(9) << "encode"
+                  << std::setw(9) << "decode" << std::setw(10) << "arch.enc" << std::setw(10) << "arch.dec" << std::setw(12) << "RSS growth"
+                  << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+        for (const auto& result : results) {
+            std::cout << std::left << std::setw(12) << result.name << std::right << std::setw(8) << result.file_count << std::setw(10)
+                      << static_cast<double>(result.raw_size) / MEGABYTE << std::setw(8) << std::setprecision(3)
+                      << static_cast<double>(result.archive_size) / result.raw_size << std::setprecision(1) << std::setw(11)
+                      << result.histogram_mbps << std::setw(9) << result.tree_mbps << std::setw(9) << result.bit_write_mbps << std::setw(9)
+                      << result.bit_read_mbps << std::setw(9) << result.encode_mbps << std::setw(9)
+                      << result.decode_mbps << std::setw(10) << result.archive_encode_mbps << std::setw(10) << result.archive_decode_mbps
+                      << std::setw(9) << result.rss_growth_kb / 1024 << " MiB" << std::endl;
+        }
+        std::cout << "Throughput in MiB/s of raw data; ratio is archive size / raw size." << std::endl;
+        std::cout << "bit.wr and bit.rd time BitWriter and BitReader alone on the codes of every block." << std::endl;
+        std::cout << "RSS growth is the peak resident memory above that of the generated dataset." << std::endl;
+    }
+
+    void PrintJson(const std::vector<Result>& results) {
+        std::cout << "{\n  \"block_size\": " << Huffman::BLOCK_SIZE << ",\n  \"datasets\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            std::cout << "    {\"name\": \"" << result.name << "\", \"files\": " << result.file_count << ", \"raw_bytes\": " << result.raw_size
+                      << ", \"archive_bytes\": " << result.archive_size << ", \"histogram_mibps\": " << result.histogram_mbps
+                      << ", \"tree_mibps\": " << result.tree_mbps << ", \"bit_write_mibps\": " << result.bit_write_mbps
+                      << ", \"bit_read_mibps\": " << result.bit_read_mbps << ", \"encode_mibps\": " << result.encode_mbps
+                      << ", \"decode_mibps\": " << result.decode_mbps << ", \"archive_encode_mibps\": " << result.archive_encode_mbps
+                      << ", \"archive_decode_mibps\": " << result.archive_decode_mbps << ", \"rss_growth_kb\": " << result.rss_growth_kb << "}"
+                      << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        std::cout << "  ]\n}" << std::endl;
+    }
+
+    // Accepts 1 to 6 decimal digits.
+    bool ParseSize(const std::string& value, size_t& size) {
+        if (value.empty() || value.size() > 6 || value.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        size = std::stoul(value);
+        return true;
+    }
+
+    void PrintHelp() {
+        std::cout << "archiver_bench [--json] [--size MiB] - benchmark the archiver on a synthetic corpus." << std::endl;
+        std::cout << "--json - print results as JSON." << std::endl;
+        std::cout << "--size MiB - size of the single-file datasets (default 16); the huge file is 8 times larger." << std::endl;
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    try {
+        bool json = false;
+        size_t size = 16;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg(argv[i]);
+            if (arg == "--json") {
+                json = true;
+            } else if (arg == "--size" && i + 1 < argc && ParseSize(argv[i + 1], size)) {
+                ++i;
+            } else {
+                PrintHelp();
+                return arg == "-h" ? 0 : 1;
+            }
+        }
+        if (size == 0) {
+            PrintHelp();
+            return 1;
+        }
+
+        std::vector<Result> results;
+        for (size_t i = 0; i < DATASET_COUNT; ++i) {
+            results.push_back(RunDatasetInChild(i, size * MEGABYTE));
+            if (!json) {
+                std::cerr << "Finished " << DATASET_NAMES[i] << "." << std::endl;
+            }
+        }
+        if (json) {
+            PrintJson(results);
+        } else {
+            PrintText(results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error!" << std::endl << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
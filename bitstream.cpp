@@ -1,6 +1,39 @@
 #include "bitstream.h"
 
-BitReader::BitReader(std::istream& in) : in_(in) {
+#include <cstddef>
+#include <stdexcept>
+
+namespace {
+    uint64_t LoadLittleEndian(const unsigned char* data) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        return word;
+    }
+
+    void StoreLittleEndian(char* data, uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        std::memcpy(data, &word, sizeof(word));
+    }
+}
+
+BitReader::BitReader(std::istream& in) : block_(STREAM_BLOCK_SIZE) {
+    in_ = &in;
+    cursor_ = nullptr;
+    end_ = nullptr;
+    buffer_ = 0;
+    buffer_size_ = 0;
+    eos_ = false;
+}
+
+BitReader::BitReader(const char* data, size_t size) {
+    in_ = nullptr;
+    cursor_ = reinterpret_cast<const unsigned char*>(data);
+    end_ = cursor_ + size;
     buffer_ = 0;
     buffer_size_ = 0;
     eos_ = false;
@@ -10,20 +43,12 @@ size_t BitReader::Read(size_t bit_count) {
     if (eos_) {
         throw std::runtime_error("BitReader: Trying to read from end of stream (EOS).");
     }
-    size_t data = 0;
-    for (size_t current_bit = 0; current_bit < bit_count; ++current_bit) {
-        if (buffer_size_ == 0) {
-            char temp;
-            if (!in_.get(temp)) {
-                temp = 0;
-                eos_ = true;
-            }
-            buffer_ = static_cast<unsigned char>(temp);
-            buffer_size_ = STANDARD_BIT_COUNT;
-        }
-        data ^= (((buffer_ >> (STANDARD_BIT_COUNT - buffer_size_)) & 0b1) << current_bit);
-        --buffer_size_;
+    if (bit_count > MAX_PEEK_BIT_COUNT) {
+        size_t low = Read(MAX_PEEK_BIT_COUNT);
+        return low ^ (Read(bit_count - MAX_PEEK_BIT_COUNT) << MAX_PEEK_BIT_COUNT);
     }
+    size_t data = Peek(bit_count);
+    Skip(bit_count);
     return data;
 }
 
@@ -31,37 +56,98 @@ bool BitReader::EndOfStream() const {
     return eos_;
 }
 
-BitWriter::BitWriter(std::ostream& out) : out_(out) {
+void BitReader::Fill() {
+    if (eos_) {
+        throw std::runtime_error("BitReader: Trying to read from end of stream (EOS).");
+    }
+    if (end_ - cursor_ >= static_cast<std::ptrdiff_t>(sizeof(uint64_t))) {
+        // Bits above buffer_size_ may hold a part of the next byte; it is OR-ed in again on the next refill.
+        buffer_ |= LoadLittleEndian(cursor_) << buffer_size_;
+        size_t byte_count = (63 - buffer_size_) >> 3;
+        cursor_ += byte_count;
+        buffer_size_ += byte_count * STANDARD_BIT_COUNT;
+        return;
+    }
+    while (buffer_size_ <= 64 - STANDARD_BIT_COUNT) {
+        if (cursor_ == end_ && !ReadBlock()) {
+            return;
+        }
+        buffer_ |= static_cast<uint64_t>(*cursor_) << buffer_size_;
+        ++cursor_;
+        buffer_size_ += STANDARD_BIT_COUNT;
+    }
+}
+
+bool BitReader::ReadBlock() {
+    if (in_ == nullptr) {
+        return false;
+    }
+    in_->read(block_.data(), block_.size());
+    size_t read_count = in_->gcount();
+    cursor_ = reinterpret_cast<const unsigned char*>(block_.data());
+    end_ = cursor_ + read_count;
+    return read_count > 0;
+}
+
+void BitReader::SkipPastEnd() {
+    buffer_ = 0;
+    buffer_size_ = 0;
+    eos_ = true;
+}
+
+BitWriter::BitWriter(std::ostream& out) : block_(STREAM_BLOCK_SIZE) {
+    out_ = &out;
+    memory_out_ = nullptr;
+    block_size_ = 0;
+    flushed_size_ = 0;
+    buffer_ = 0;
+    buffer_size_ = 0;
+}
+
+BitWriter::BitWriter(std::vector<char>& out) : block_(STREAM_BLOCK_SIZE) {
+    out_ = nullptr;
+    memory_out_ = &out;
+    block_size_ = 0;
+    flushed_size_ = 0;
     buffer_ = 0;
     buffer_size_ = 0;
 }
 
 BitWriter::~BitWriter() {
+    FlushBuffer();
     if (buffer_size_ > 0) {
-        out_.write(reinterpret_cast<char*>(&buffer_), 1);
+        buffer_size_ = STANDARD_BIT_COUNT;
+        FlushBuffer();
     }
+    FlushBlock();
 }
 
-void BitWriter::Write(uint64_t data, size_t bit_count) {
-    for (size_t current_bit = 0; current_bit < bit_count; ++current_bit) {
-        buffer_ ^= (((data >> current_bit) & 0b1) << buffer_size_);
-        ++buffer_size_;
-        if (buffer_size_ == STANDARD_BIT_COUNT) {
-            out_.write(reinterpret_cast<char*>(&buffer_), 1);
-            buffer_ = 0;
-            buffer_size_ = 0;
-        }
+void BitWriter::WriteLong(uint64_t data, size_t bit_count) {
+    Write(data, MAX_PEEK_BIT_COUNT);
+    Write(data >> MAX_PEEK_BIT_COUNT, bit_count - MAX_PEEK_BIT_COUNT);
+}
+
+size_t BitWriter::BitCount() const {
+    return (flushed_size_ + block_size_) * STANDARD_BIT_COUNT + buffer_size_;
+}
+
+void BitWriter::FlushBuffer() {
+    if (block_size_ + sizeof(uint64_t) > block_.size()) {
+        FlushBlock();
     }
+    size_t byte_count = buffer_size_ / STANDARD_BIT_COUNT;
+    StoreLittleEndian(block_.data() + block_size_, buffer_);
+    block_size_ += byte_count;
+    buffer_ = (byte_count == sizeof(uint64_t) ? 0 : buffer_ >> (byte_count * STANDARD_BIT_COUNT));
+    buffer_size_ -= byte_count * STANDARD_BIT_COUNT;
 }
 
-void BitWriter::Write(std::vector<bool> data, size_t bit_count) {
-    for (size_t current_bit = 0; current_bit < bit_count; ++current_bit) {
-        buffer_ ^= ((data[current_bit]) << buffer_size_);
-        ++buffer_size_;
-        if (buffer_size_ == STANDARD_BIT_COUNT) {
-            out_.write(reinterpret_cast<char*>(&buffer_), 1);
-            buffer_ = 0;
-            buffer_size_ = 0;
-        }
+void BitWriter::FlushBlock() {
+    if (out_ != nullptr) {
+        out_->write(block_.data(), block_size_);
+    } else {
+        memory_out_->insert(memory_out_->end(), block_.begin(), block_.begin() + block_size_);
     }
+    flushed_size_ += block_size_;
+    block_size_ = 0;
 }
@@ -1,36 +1,91 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <istream>
 #include <ostream>
 #include <string>
 #include <vector>
 
 const size_t STANDARD_BIT_COUNT = 8;
+const size_t MAX_PEEK_BIT_COUNT = 56;
+const size_t STREAM_BLOCK_SIZE = 1 << 16;
 
+// Bits are packed LSB-first: the first bit of the stream is bit 0 of the first byte.
+// Both classes keep a 64-bit accumulator and move data to and from the stream in STREAM_BLOCK_SIZE blocks.
 class BitReader {
 public:
     explicit BitReader(std::istream& in);
+    BitReader(const char* data, size_t size);
 
     size_t Read(size_t bit_count = STANDARD_BIT_COUNT);
     bool EndOfStream() const;
 
+    // Returns the next bit_count (at most MAX_PEEK_BIT_COUNT) bits without consuming them.
+    // Bits past the end of the stream read as zeros.
+    size_t Peek(size_t bit_count) {
+        if (buffer_size_ < bit_count) {
+            Fill();
+        }
+        return buffer_ & ((uint64_t(1) << bit_count) - 1);
+    }
+
+    void Skip(size_t bit_count) {
+        if (buffer_size_ < bit_count) {
+            Fill();
+            if (buffer_size_ < bit_count) {
+                SkipPastEnd();
+                return;
+            }
+        }
+        buffer_ >>= bit_count;
+        buffer_size_ -= bit_count;
+    }
+
 private:
-    std::istream& in_;
-    size_t buffer_;
+    std::istream* in_;
+    std::vector<char> block_;
+    const unsigned char* cursor_;
+    const unsigned char* end_;
+    uint64_t buffer_;
     size_t buffer_size_;
     bool eos_;
+
+    void Fill();
+    bool ReadBlock();
+    void SkipPastEnd();
 };
 
 class BitWriter {
 public:
     explicit BitWriter(std::ostream& out);
+    explicit BitWriter(std::vector<char>& out);
     ~BitWriter();
 
-    void Write(uint64_t data, size_t bit_count = STANDARD_BIT_COUNT);
-    void Write(std::vector<bool> data, size_t bit_count = STANDARD_BIT_COUNT);
+    size_t BitCount() const;
+
+    void Write(uint64_t data, size_t bit_count = STANDARD_BIT_COUNT) {
+        if (bit_count > MAX_PEEK_BIT_COUNT) {
+            WriteLong(data, bit_count);
+            return;
+        }
+        if (buffer_size_ + bit_count >= 64) {
+            FlushBuffer();
+        }
+        buffer_ |= (data & ((uint64_t(1) << bit_count) - 1)) << buffer_size_;
+        buffer_size_ += bit_count;
+    }
 
 private:
-    std::ostream& out_;
-    size_t buffer_;
+    std::ostream* out_;
+    std::vector<char>* memory_out_;
+    std::vector<char> block_;
+    size_t block_size_;
+    size_t flushed_size_;
+    uint64_t buffer_;
     size_t buffer_size_;
+
+    void WriteLong(uint64_t data, size_t bit_count);
+    void FlushBuffer();
+    void FlushBlock();
 };
@@ -0,0 +1,686 @@
+#include "block.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include "decodetable.h"
+#include "encodekernel.h"
+#include "histogram.h"
+
+namespace Huffman {
+    namespace {
+        size_t GetCodeSize(const std::vector<size_t>& char_count, const HuffmanTree::CodeTable& encoded_chars) {
+            size_t bit_count = 0;
+            for (Letter i = 0; i < char_count.size(); ++i) {
+                bit_count += char_count[i] * encoded_chars[i].codelen;
+            }
+            return bit_count;
+        }
+
+        size_t GetLongestCode(const HuffmanTree::CodeTable& encoded_chars) {
+            size_t longest = 0;
+            for (const auto& encoded_char : encoded_chars) {
+                longest = std::max(longest, encoded_char.codelen);
+            }
+            return longest;
+        }
+
+        // Optimal codes for char_count, or package-merge codes when those are longer than the options allow.
+        HuffmanTree::CodeTable GetCodes(const std::vector<size_t>& char_count, const BlockOptions& options, size_t& length_limit_cost) {
+            HuffmanTree::CodeTable encoded_chars = HuffmanTree::GetEncodedChars(char_count);
+            length_limit_cost = 0;
+            if (GetLongestCode(encoded_chars) > options.max_code_length) {
+                HuffmanTree::CodeTable limited_chars = HuffmanTree::GetLengthLimitedCodes(char_count, options.max_code_length);
+                length_limit_cost = GetCodeSize(char_count, limited_chars) - GetCodeSize(char_count, encoded_chars);
+                return limited_chars;
+            }
+            return encoded_chars;
+        }
+
+        // Bit-level parts of a payload are written here with a BitWriter, then appended to the payload.
+        std::vector<char>& BitScratch() {
+            thread_local std::vector<char> scratch;
+            scratch.clear();
+            return scratch;
+        }
+
+        size_t GetCodeLengthsSize(const HuffmanTree::CodeTable& encoded_chars) {
+            size_t symbols_count = 0;
+            for (const auto& encoded_char : encoded_chars) {
+                symbols_count += encoded_char.codelen > 0;
+            }
+            return SYMBOL_SIZE * (1 + symbols_count + GetLongestCode(encoded_chars));
+        }
+
+        // Writes the code lengths of header_chars unless it is null, then the codes of data from encoded_chars.
+        // Returns the payload size in bits.
+        size_t WriteCodes(PayloadBuffer& payload, const HuffmanTree::CodeTable& encoded_chars,
+            const HuffmanTree::CodeTable* header_chars, const unsigned char* data, size_t size) {
+            size_t header_bits = 0;
+            if (header_chars != nullptr) {
+                std::vector<char>& header = BitScratch();
+                {
+                    BitWriter writer(header);
+                    WriteCodeLengths(writer, *header_chars);
+                    header_bits = writer.BitCount();
+                }
+                payload.Append(header.data(), header.size());
+            }
+            return AppendCodes(payload, header_bits, encoded_chars, data, size);
+        }
+
+        // SAMPLE_ESCAPE is only valid in the tables of sampled blocks.
+        DecodeTable ReadBlockTable(BitReader& reader, size_t& header_bits, size_t& max_code_length, bool escapes = false) {
+            std::vector<std::pair<size_t, Letter>> char_codelen = ReadCodeLengths(reader);
+            for (const auto& [codelen, char_value] : char_codelen) {
+                if (char_value > (escapes ? SAMPLE_ESCAPE : 0xFF)) {
+                    throw std::runtime_error("DecodeBlock: Malformed code table.");
+                }
+            }
+            max_code_length = char_codelen.back().first;
+            header_bits = SYMBOL_SIZE * (1 + char_codelen.size() + max_code_length);
+            return DecodeTable(char_codelen);
+        }
+
+        void WriteInterleavedCodes(PayloadBuffer& payload, const HuffmanTree::CodeTable& encoded_chars,
+            const HuffmanTree::CodeTable* header_chars, const unsigned char* data, size_t size) {
+            // Scratch space of the calling thread, reused by all blocks it codes.
+            thread_local std::vector<char> streams[INTERLEAVED_STREAM_COUNT];
+            for (auto& stream : streams) {
+                stream.clear();
+            }
+            AppendInterleavedCodes(streams, encoded_chars, data, size);
+            std::vector<char>& header = BitScratch();
+            {
+                BitWriter writer(header);
+                if (header_chars != nullptr) {
+                    WriteCodeLengths(writer, *header_chars);
+                }
+                for (size_t stream = 0; stream + 1 < INTERLEAVED_STREAM_COUNT; ++stream) {
+                    writer.Write(streams[stream].size(), INTERLEAVED_SIZE_BITS);
+                }
+            }
+            payload.Append(header.data(), header.size());
+            for (const auto& stream : streams) {
+                payload.Append(stream.data(), stream.size());
+            }
+        }
+
+        struct ContextModel {
+            // Index into tables for every previous byte; own[context] tells whether the table is its own.
+            std::array<size_t, CONTEXT_COUNT> table_of_context;
+            std::array<bool, CONTEXT_COUNT> own;
+            // Own tables in order of the previous byte, then the fallback table if any context uses it.
+            std::vector<HuffmanTree::CodeTable> tables;
+            bool has_fallback;
+            size_t bit_count;
+            size_t length_limit_cost;
+        };
+
+        // A context gets its own table when that, with its code lengths, is smaller than coding its bytes
+        // with the block's order-0 code; the fallback table is then built from all remaining contexts.
+        ContextModel BuildContextModel(const unsigned char* data, size_t size, const std::vector<size_t>& char_count,
+            const BlockOptions& options) {
+            std::vector<uint32_t> pair_count(CONTEXT_COUNT * CONTEXT_COUNT);
+            unsigned char previous = 0;
+            for (size_t i = 0; i < size; ++i) {
+                ++pair_count[previous * CONTEXT_COUNT + data[i]];
+                previous = data[i];
+            }
+            ContextModel model;
+            model.bit_count = CONTEXT_COUNT + 1;
+            model.length_limit_cost = 0;
+            size_t length_limit_cost;
+            HuffmanTree::CodeTable order0_chars = GetCodes(char_count, options, length_limit_cost);
+            std::vector<size_t> fallback_count(SYMBOLS_COUNT);
+            std::vector<size_t> context_count(SYMBOLS_COUNT);
+            for (size_t context = 0; context < CONTEXT_COUNT; ++context) {
+                std::copy(pair_count.begin() + context * CONTEXT_COUNT, pair_count.begin() + (context + 1) * CONTEXT_COUNT, context_count.begin());
+                model.own[context] = false;
+                if (std::all_of(context_count.begin(), context_count.end(), [](size_t count) { return count == 0; })) {
+                    continue;
+                }
+                HuffmanTree::CodeTable encoded_chars = GetCodes(context_count, options, length_limit_cost);
+                size_t own_bits = GetCodeLengthsSize(encoded_chars) + GetCodeSize(context_count, encoded_chars);
+                if (own_bits < GetCodeSize(context_count, order0_chars)) {
+                    model.own[context] = true;
+                    model.table_of_context[context] = model.tables.size();
+                    model.tables.push_back(encoded_chars);
+                    model.bit_count += own_bits;
+                    model.length_limit_cost += length_limit_cost;
+                } else {
+                    for (size_t i = 0; i < CONTEXT_COUNT; ++i) {
+                        fallback_count[i] += context_count[i];
+                    }
+                }
+            }
+            model.has_fallback = std::any_of(fallback_count.begin(), fallback_count.end(), [](size_t count) { return count > 0; });
+            if (model.has_fallback) {
+                for (size_t context = 0; context < CONTEXT_COUNT; ++context) {
+                    if (!model.own[context]) {
+                        model.table_of_context[context] = model.tables.size();
+                    }
+                }
+                model.tables.push_back(GetCodes(fallback_count, options, length_limit_cost));
+                model.bit_count += GetCodeLengthsSize(model.tables.back()) + GetCodeSize(fallback_count, model.tables.back());
+                model.length_limit_cost += length_limit_cost;
+            }
+            return model;
+        }
+
+        size_t WriteContextCodes(PayloadBuffer& payload, const ContextModel& model, const unsigned char* data, size_t size) {
+            std::vector<char>& codes = BitScratch();
+            size_t bit_count = 0;
+            {
+                BitWriter writer(codes);
+                for (bool own : model.own) {
+                    writer.Write(own, 1);
+                }
+                writer.Write(model.has_fallback, 1);
+                for (const auto& table : model.tables) {
+                    WriteCodeLengths(writer, table);
+                }
+                std::array<const HuffmanTree::CodeTable*, CONTEXT_COUNT> tables;
+                for (size_t context = 0; context < CONTEXT_COUNT; ++context) {
+                    tables[context] = model.own[context] || model.has_fallback ? &model.tables[model.table_of_context[context]] : nullptr;
+                }
+                unsigned char previous = 0;
+                for (size_t i = 0; i < size; ++i) {
+                    const auto& encoded_char = (*tables[previous])[data[i]];
+                    writer.Write(encoded_char.code, encoded_char.codelen);
+                    previous = data[i];
+                }
+                bit_count = writer.BitCount();
+            }
+            payload.Append(codes.data(), codes.size());
+            return bit_count;
+        }
+
+        void DecodeContexts(const BlockView& block, BitReader& reader, unsigned char* out, size_t& max_code_length) {
+            std::array<bool, CONTEXT_COUNT> own;
+            for (size_t context = 0; context < CONTEXT_COUNT; ++context) {
+                own[context] = reader.Read(1) != 0;
+            }
+            bool has_fallback = reader.Read(1) != 0;
+            std::vector<DecodeTable> decode_tables;
+            decode_tables.reserve(CONTEXT_COUNT + 1);
+            size_t header_bits;
+            size_t table_code_length;
+            max_code_length = 0;
+            for (size_t context = 0; context < CONTEXT_COUNT + has_fallback; ++context) {
+                if (context == CONTEXT_COUNT || own[context]) {
+                    decode_tables.push_back(ReadBlockTable(reader, header_bits, table_code_length));
+                    max_code_length = std::max(max_code_length, table_code_length);
+                }
+            }
+            std::array<DecodeTable*, CONTEXT_COUNT> tables;
+            size_t next_table = 0;
+            for (size_t context = 0; context < CONTEXT_COUNT; ++context) {
+                tables[context] = own[context] ? &decode_tables[next_table++] : nullptr;
+            }
+            for (size_t context = 0; context < CONTEXT_COUNT; ++context) {
+                if (!own[context] && has_fallback) {
+                    tables[context] = &decode_tables.back();
+                }
+            }
+            unsigned char previous = 0;
+            for (size_t i = 0; i < block.raw_size; ++i) {
+                DecodeTable* table = tables[previous];
+                if (table == nullptr) {
+                    throw std::runtime_error("DecodeBlock: Malformed block.");
+                }
+                out[i] = static_cast<unsigned char>(table->Decode(reader));
+                previous = out[i];
+            }
+        }
+
+        size_t WritePresetCodes(PayloadBuffer& payload, Preset preset, const unsigned char* data, size_t size) {
+            std::vector<char>& header = BitScratch();
+            {
+                BitWriter writer(header);
+                writer.Write(static_cast<uint8_t>(preset), PRESET_ID_BITS);
+            }
+            payload.Append(header.data(), header.size());
+            return AppendCodes(payload, PRESET_ID_BITS, GetPresetTable(preset).encoded_chars, data, size);
+        }
+
+        void DecodePreset(const BlockView& block, BitReader& reader, unsigned char* out) {
+            Preset preset = static_cast<Preset>(reader.Read(PRESET_ID_BITS));
+            if (!IsStoredPreset(preset)) {
+                throw std::runtime_error("DecodeBlock: Unknown preset.");
+            }
+            const auto& entries = GetPresetTable(preset).decode_entries;
+            for (size_t i = 0; i < block.raw_size; ++i) {
+                auto entry = entries[reader.Peek(PRESET_MAX_CODE_LENGTH) & (entries.size() - 1)];
+                if (entry.length == 0) {
+                    throw std::runtime_error("DecodeBlock: Invalid code in stream.");
+                }
+                reader.Skip(entry.length);
+                out[i] = entry.value;
+            }
+        }
+
+        // Sampled blocks code bytes missing from their sample as SAMPLE_ESCAPE followed by the byte.
+        template <bool escapes>
+        unsigned char DecodeByte(const DecodeTable& table, BitReader& reader) {
+            Letter symbol = table.Decode(reader);
+            if (escapes && symbol == SAMPLE_ESCAPE) {
+                symbol = reader.Peek(BYTE_SIZE);
+                reader.Skip(BYTE_SIZE);
+            }
+            return static_cast<unsigned char>(symbol);
+        }
+
+        // header_bits is the size of the code lengths already read from reader, 0 for shared tables.
+        template <bool escapes>
+        void DecodeInterleaved(const BlockView& block, BitReader& reader, size_t header_bits, const DecodeTable& table, unsigned char* out) {
+            size_t offset = (header_bits + (INTERLEAVED_STREAM_COUNT - 1) * INTERLEAVED_SIZE_BITS + BYTE_SIZE - 1) / BYTE_SIZE;
+            if (offset > block.payload_size) {
+                throw std::runtime_error("DecodeBlock: Malformed block.");
+            }
+            size_t stream_sizes[INTERLEAVED_STREAM_COUNT];
+            size_t rest = block.payload_size - offset;
+            for (size_t stream = 0; stream + 1 < INTERLEAVED_STREAM_COUNT; ++stream) {
+                stream_sizes[stream] = reader.Read(INTERLEAVED_SIZE_BITS);
+                if (stream_sizes[stream] > rest) {
+                    throw std::runtime_error("DecodeBlock: Malformed block.");
+                }
+                rest -= stream_sizes[stream];
+            }
+            stream_sizes[INTERLEAVED_STREAM_COUNT - 1] = rest;
+
+            const char* data = block.payload + offset;
+            BitReader streams[INTERLEAVED_STREAM_COUNT] = { BitReader(data, stream_sizes[0]),
+                BitReader(data + stream_sizes[0], stream_sizes[1]),
+                BitReader(data + stream_sizes[0] + stream_sizes[1], stream_sizes[2]),
+                BitReader(data + stream_sizes[0] + stream_sizes[1] + stream_sizes[2], stream_sizes[3]) };
+            size_t i = 0;
+            for (; i + INTERLEAVED_STREAM_COUNT <= block.raw_size; i += INTERLEAVED_STREAM_COUNT) {
+                out[i] = DecodeByte<escapes>(table, streams[0]);
+                out[i + 1] = DecodeByte<escapes>(table, streams[1]);
+                out[i + 2] = DecodeByte<escapes>(table, streams[2]);
+                out[i + 3] = DecodeByte<escapes>(table, streams[3]);
+            }
+            for (size_t stream = 0; i < block.raw_size; ++i, ++stream) {
+                out[i] = DecodeByte<escapes>(table, streams[stream]);
+            }
+        }
+
+        template <bool escapes>
+        void DecodeCodes(const BlockView& block, BitReader& reader, size_t header_bits, const DecodeTable& table, unsigned char* out) {
+            if (block.type == BlockType::HUFFMAN_X4 || block.type == BlockType::HUFFMAN_SHARED_X4 ||
+                block.type == BlockType::HUFFMAN_SAMPLED_X4) {
+                DecodeInterleaved<escapes>(block, reader, header_bits, table, out);
+                return;
+            }
+            for (size_t i = 0; i < block.raw_size; ++i) {
+                out[i] = DecodeByte<escapes>(table, reader);
+            }
+        }
+
+        const size_t SAMPLE_SIZE = SAMPLE_HEAD_SIZE + SAMPLE_CHUNK_COUNT * SAMPLE_CHUNK_SIZE;
+
+        // Byte counts of the sample of a block longer than SAMPLE_SIZE.
+        std::vector<size_t> CountSample(const unsigned char* data, size_t size) {
+            std::vector<size_t> char_count = CountBytes(data, SAMPLE_HEAD_SIZE);
+            size_t stride = (size - SAMPLE_HEAD_SIZE) / SAMPLE_CHUNK_COUNT;
+            for (size_t chunk = 0; chunk < SAMPLE_CHUNK_COUNT; ++chunk) {
+                std::vector<size_t> chunk_count = CountBytes(data + SAMPLE_HEAD_SIZE + chunk * stride, SAMPLE_CHUNK_SIZE);
+                for (size_t i = 0; i <= 0xFF; ++i) {
+                    char_count[i] += chunk_count[i];
+                }
+            }
+            return char_count;
+        }
+
+        // Codes a block in one pass with a table built from its sample. Without stats nothing else is read,
+        // so whether the block shrinks is only known once it is coded.
+        EncodedBlock EncodeSampledBlock(PayloadBuffer& payload, const unsigned char* data, size_t size, const BlockOptions& options,
+            BlockStats* stats) {
+            PhaseTimer timer(stats != nullptr);
+            std::vector<size_t> char_count = CountSample(data, size);
+            // Bytes missing from the sample are taken to be as frequent as all those seen once in it. A sample
+            // with every byte value needs no escape, which also keeps the table within 8-bit code lengths.
+            if (std::find(char_count.begin(), char_count.begin() + 0x100, 0) != char_count.begin() + 0x100) {
+                char_count[SAMPLE_ESCAPE] = std::max<size_t>(std::count(char_count.begin(), char_count.begin() + 0x100, 1), 1);
+            }
+            double histogram_seconds = timer.Lap();
+
+            EncodedBlock block = { BlockType::STORED, size, 0, {}, 0 };
+            HuffmanTree::CodeTable header_chars = {};
+            HuffmanTree::CodeTable encoded_chars = {};
+            size_t raw_bits = size * BYTE_SIZE;
+            // The lower bound of EncodeBlock, with the entropy of the sample standing for that of the block.
+            double entropy_bits = GetEntropyBits(char_count) * size / SAMPLE_SIZE;
+            size_t symbols_count = SYMBOLS_COUNT - std::count(char_count.begin(), char_count.end(), 0);
+            bool may_pay_off = entropy_bits + SYMBOL_SIZE * (2 + symbols_count) < raw_bits;
+            size_t length_limit_cost = 0;
+            if (may_pay_off) {
+                header_chars = GetCodes(char_count, options, length_limit_cost);
+                // The entropy of a sample underestimates that of the block; near-random data is caught here
+                // by the size its code would have on the sample, before the whole block is coded.
+                may_pay_off = GetCodeLengthsSize(header_chars) + GetCodeSize(char_count, header_chars) * size / SAMPLE_SIZE < raw_bits;
+                encoded_chars = header_chars;
+                const auto& escape = header_chars[SAMPLE_ESCAPE];
+                for (Letter i = 0; i <= 0xFF; ++i) {
+                    if (encoded_chars[i].codelen == 0) {
+                        encoded_chars[i].code = escape.code | Code(i) << escape.codelen;
+                        encoded_chars[i].codelen = escape.codelen + BYTE_SIZE;
+                    }
+                }
+            }
+            double tree_seconds = timer.Lap();
+            if (may_pay_off && options.interleave && size >= INTERLEAVED_MIN_BLOCK_SIZE) {
+                block.type = BlockType::HUFFMAN_SAMPLED_X4;
+                WriteInterleavedCodes(payload, encoded_chars, &header_chars, data, size);
+                block.bit_count = payload.Size() * BYTE_SIZE;
+            } else if (may_pay_off) {
+                block.type = BlockType::HUFFMAN_SAMPLED;
+                block.bit_count = WriteCodes(payload, encoded_chars, &header_chars, data, size);
+            }
+            block.length_limit_cost = length_limit_cost * size / SAMPLE_SIZE;
+            if (block.type == BlockType::STORED || block.bit_count >= raw_bits) {
+                block.type = BlockType::STORED;
+                block.length_limit_cost = 0;
+                payload.Assign(reinterpret_cast<const char*>(data), size);
+                block.bit_count = raw_bits;
+            }
+            if (stats != nullptr) {
+                stats->raw_size = size;
+                stats->payload_bits = block.bit_count;
+                stats->max_code_length = block.type != BlockType::STORED ? GetLongestCode(header_chars) : 0;
+                stats->histogram_seconds = histogram_seconds;
+                stats->tree_seconds = tree_seconds;
+                stats->code_seconds = timer.Lap();
+                // Only measured, and left out of the phase times: the code EncodeBlock would build from all bytes.
+                std::vector<size_t> exact_count = CountBytes(data, size);
+                HuffmanTree::CodeTable exact_chars = GetCodes(exact_count, options, length_limit_cost);
+                size_t exact_bits = GetCodeLengthsSize(exact_chars) + GetCodeSize(exact_count, exact_chars);
+                if (options.interleave && size >= INTERLEAVED_MIN_BLOCK_SIZE) {
+                    exact_bits += (INTERLEAVED_STREAM_COUNT - 1) * INTERLEAVED_SIZE_BITS;
+                }
+                stats->entropy_bits = GetEntropyBits(exact_count);
+                stats->sampling_cost_bits = static_cast<int64_t>(block.bit_count) - static_cast<int64_t>(std::min(exact_bits, raw_bits));
+            }
+            return block;
+        }
+
+        // EncodeBlock with the payload going to payload instead of the block.
+        EncodedBlock EncodePayload(PayloadBuffer& payload, const unsigned char* data, size_t size, const BlockOptions& options,
+            BlockStats* stats, const HuffmanTree::CodeTable* shared_table) {
+            PhaseTimer timer(stats != nullptr);
+            bool presets_fit = options.max_code_length >= PRESET_MAX_CODE_LENGTH;
+            if (presets_fit && IsStoredPreset(options.preset)) {
+                EncodedBlock block = { BlockType::PRESET, size, 0, {}, 0 };
+                block.bit_count = WritePresetCodes(payload, options.preset, data, size);
+                if (block.bit_count >= size * BYTE_SIZE) {
+                    block.type = BlockType::STORED;
+                    payload.Assign(reinterpret_cast<const char*>(data), size);
+                    block.bit_count = size * BYTE_SIZE;
+                }
+                if (stats != nullptr) {
+                    stats->raw_size = size;
+                    stats->payload_bits = block.bit_count;
+                    stats->max_code_length = block.type == BlockType::PRESET ? PRESET_MAX_CODE_LENGTH : 0;
+                    stats->code_seconds = timer.Lap();
+                    // Only measured: the preset needs no histogram.
+                    stats->entropy_bits = GetEntropyBits(CountBytes(data, size));
+                    stats->histogram_seconds = timer.Lap();
+                }
+                return block;
+            }
+            if (options.sample && size > SAMPLE_SIZE) {
+                return EncodeSampledBlock(payload, data, size, options, stats);
+            }
+            std::vector<size_t> char_count = CountBytes(data, size);
+            double histogram_seconds = timer.Lap();
+
+            EncodedBlock block = { BlockType::STORED, size, 0, {}, 0 };
+            Preset preset = Preset::NONE;
+            size_t preset_bits = SIZE_MAX;
+            for (size_t id = 1; presets_fit && options.preset == Preset::AUTO && id <= PRESET_COUNT; ++id) {
+                size_t bits = PRESET_ID_BITS + GetCodeSize(char_count, GetPresetTable(static_cast<Preset>(id)).encoded_chars);
+                if (bits < preset_bits) {
+                    preset = static_cast<Preset>(id);
+                    preset_bits = bits;
+                }
+            }
+            HuffmanTree::CodeTable encoded_chars = {};
+            size_t raw_bits = size * BYTE_SIZE;
+            size_t shared_bits = shared_table != nullptr ? GetCodeSize(char_count, *shared_table) : SIZE_MAX;
+            // A code of the block's own never beats its entropy and its table takes at least SYMBOL_SIZE bits
+            // per symbol, so blocks that cannot shrink are stored without building a tree.
+            double entropy_bits = GetEntropyBits(char_count);
+            size_t symbols_count = SYMBOLS_COUNT - std::count(char_count.begin(), char_count.end(), 0);
+            bool may_pay_off = std::min(shared_bits, preset_bits) < raw_bits || entropy_bits + SYMBOL_SIZE * (2 + symbols_count) < raw_bits;
+            bool shared = false;
+            size_t best_bits = raw_bits;
+            if (may_pay_off) {
+                encoded_chars = GetCodes(char_count, options, block.length_limit_cost);
+                size_t own_bits = GetCodeLengthsSize(encoded_chars) + GetCodeSize(char_count, encoded_chars);
+                shared = shared_bits <= own_bits;
+                if (shared) {
+                    encoded_chars = *shared_table;
+                    block.length_limit_cost = 0;
+                }
+                may_pay_off = std::min(own_bits, shared_bits) < raw_bits;
+                best_bits = std::min({ own_bits, shared_bits, raw_bits });
+            }
+            bool use_preset = preset_bits < best_bits;
+            if (use_preset) {
+                best_bits = preset_bits;
+            }
+            // Even data without order-0 redundancy may be predictable from the previous byte.
+            ContextModel model;
+            bool use_context = false;
+            if (options.context_model && size >= CONTEXT_MIN_BLOCK_SIZE) {
+                model = BuildContextModel(data, size, char_count, options);
+                use_context = model.bit_count < best_bits;
+            }
+            use_preset = use_preset && !use_context;
+            double tree_seconds = timer.Lap();
+            if (use_preset) {
+                block.type = BlockType::PRESET;
+                block.length_limit_cost = 0;
+                block.bit_count = WritePresetCodes(payload, preset, data, size);
+                encoded_chars = GetPresetTable(preset).encoded_chars;
+                may_pay_off = true;
+            } else if (use_context) {
+                block.type = BlockType::HUFFMAN_CONTEXT;
+                block.length_limit_cost = model.length_limit_cost;
+                block.bit_count = WriteContextCodes(payload, model, data, size);
+            } else if (!may_pay_off) {
+                block.type = BlockType::STORED;
+                block.length_limit_cost = 0;
+                payload.Assign(reinterpret_cast<const char*>(data), size);
+                block.bit_count = raw_bits;
+            } else if (options.interleave && size >= INTERLEAVED_MIN_BLOCK_SIZE) {
+                block.type = shared ? BlockType::HUFFMAN_SHARED_X4 : BlockType::HUFFMAN_X4;
+                WriteInterleavedCodes(payload, encoded_chars, shared ? nullptr : &encoded_chars, data, size);
+                block.bit_count = payload.Size() * BYTE_SIZE;
+            } else {
+                block.type = shared ? BlockType::HUFFMAN_SHARED : BlockType::HUFFMAN;
+                block.bit_count = WriteCodes(payload, encoded_chars, shared ? nullptr : &encoded_chars, data, size);
+            }
+            // The estimates above leave out the stream sizes and padding of interleaved blocks.
+            if (block.type != BlockType::STORED && block.bit_count >= raw_bits) {
+                block.type = BlockType::STORED;
+                block.length_limit_cost = 0;
+                payload.Assign(reinterpret_cast<const char*>(data), size);
+                block.bit_count = raw_bits;
+                may_pay_off = false;
+                use_context = false;
+            }
+            if (stats != nullptr) {
+                stats->raw_size = size;
+                stats->payload_bits = block.bit_count;
+                stats->entropy_bits = entropy_bits;
+                stats->max_code_length = may_pay_off && !use_context ? GetLongestCode(encoded_chars) : 0;
+                for (size_t i = 0; use_context && i < model.tables.size(); ++i) {
+                    stats->max_code_length = std::max(stats->max_code_length, GetLongestCode(model.tables[i]));
+                }
+                stats->histogram_seconds = histogram_seconds;
+                stats->tree_seconds = tree_seconds;
+                stats->code_seconds = timer.Lap();
+            }
+            return block;
+        }
+    }
+
+    EncodedBlock EncodeBlock(const unsigned char* data, size_t size, const BlockOptions& options, BlockStats* stats,
+        const HuffmanTree::CodeTable* shared_table) {
+        std::vector<char> payload;
+        PayloadBuffer buffer(payload);
+        EncodedBlock block = EncodePayload(buffer, data, size, options, stats, shared_table);
+        block.payload = std::move(payload);
+        return block;
+    }
+
+    EncodedBlock EncodeBlock(PayloadBuffer& payload, const unsigned char* data, size_t size, const BlockOptions& options,
+        BlockStats* stats, const HuffmanTree::CodeTable* shared_table) {
+        try {
+            return EncodePayload(payload, data, size, options, stats, shared_table);
+        } catch (const PayloadOverflow&) {
+            // With room for the raw bytes, only a code about as long as them overflows; the block is stored.
+            payload.Assign(reinterpret_cast<const char*>(data), size);
+            if (stats != nullptr) {
+                stats->raw_size = size;
+                stats->payload_bits = size * BYTE_SIZE;
+                stats->max_code_length = 0;
+            }
+            return { BlockType::STORED, size, size * BYTE_SIZE, {}, 0 };
+        }
+    }
+
+    void DecodeBlock(const EncodedBlock& block, unsigned char* out, BlockStats* stats, const DecodeTable* shared_table) {
+        DecodeBlock(BlockView{ block.type, block.raw_size, block.bit_count, block.payload.data(), block.payload.size() }, out, stats,
+            shared_table);
+    }
+
+    void DecodeBlock(const BlockView& block, unsigned char* out, BlockStats* stats, const DecodeTable* shared_table) {
+        PhaseTimer timer(stats != nullptr);
+        if (block.type > BlockType::HUFFMAN_SAMPLED_X4 || block.payload_size * BYTE_SIZE < block.bit_count) {
+            throw std::runtime_error("DecodeBlock: Malformed block.");
+        }
+        BitReader reader(block.payload, block.payload_size);
+        size_t max_code_length = 0;
+        double tree_seconds = 0;
+        if (block.type == BlockType::STORED) {
+            if (block.payload_size != block.raw_size) {
+                throw std::runtime_error("DecodeBlock: Malformed block.");
+            }
+            std::memcpy(out, block.payload, block.raw_size);
+        } else if (block.type == BlockType::HUFFMAN_CONTEXT) {
+            DecodeContexts(block, reader, out, max_code_length);
+        } else if (block.type == BlockType::PRESET) {
+            DecodePreset(block, reader, out);
+            max_code_length = PRESET_MAX_CODE_LENGTH;
+        } else {
+            bool shared = block.type == BlockType::HUFFMAN_SHARED || block.type == BlockType::HUFFMAN_SHARED_X4;
+            bool sampled = block.type == BlockType::HUFFMAN_SAMPLED || block.type == BlockType::HUFFMAN_SAMPLED_X4;
+            if (shared && shared_table == nullptr) {
+                throw std::runtime_error("DecodeBlock: Block refers to a missing shared code table.");
+            }
+            size_t header_bits = 0;
+            std::optional<DecodeTable> own_table;
+            if (shared) {
+                max_code_length = shared_table->MaxCodeLength();
+            } else {
+                own_table.emplace(ReadBlockTable(reader, header_bits, max_code_length, sampled));
+            }
+            const DecodeTable& table = shared ? *shared_table : *own_table;
+            tree_seconds = timer.Lap();
+            if (sampled) {
+                DecodeCodes<true>(block, reader, header_bits, table, out);
+            } else {
+                DecodeCodes<false>(block, reader, header_bits, table, out);
+            }
+        }
+        if (stats != nullptr) {
+            stats->raw_size = block.raw_size;
+            stats->payload_bits = block.bit_count;
+            stats->max_code_length = max_code_length;
+            stats->tree_seconds = tree_seconds;
+            stats->code_seconds = timer.Lap();
+            // The decoder has no histogram of its own; counting the output is part of the measurement.
+            stats->entropy_bits = GetEntropyBits(CountBytes(out, block.raw_size));
+            stats->histogram_seconds = timer.Lap();
+        }
+    }
+
+    HuffmanTree::CodeTable BuildSharedTable(std::vector<size_t> char_count, const BlockOptions& options) {
+        for (size_t i = 0; i <= 0xFF; ++i) {
+            char_count[i] = std::max<size_t>(char_count[i], 1);
+        }
+        size_t length_limit_cost;
+        return GetCodes(char_count, options, length_limit_cost);
+    }
+
+    DecodeTable ReadSharedTable(BitReader& reader) {
+        size_t header_bits;
+        size_t max_code_length;
+        return ReadBlockTable(reader, header_bits, max_code_length);
+    }
+
+    void WriteCodeLengths(BitWriter& writer, const HuffmanTree::CodeTable& encoded_chars) {
+        std::vector<std::pair<size_t, Letter>> char_codelen;
+        for (const auto& encoded_char : encoded_chars) {
+            if (encoded_char.codelen > 0) {
+                char_codelen.push_back({ encoded_char.codelen, encoded_char.char_value });
+            }
+        }
+        std::sort(char_codelen.begin(), char_codelen.end());
+
+        size_t symbols_count = char_codelen.size();
+        writer.Write(symbols_count, Huffman::SYMBOL_SIZE);
+        for (size_t i = 0; i < symbols_count; ++i) {
+            writer.Write(char_codelen[i].second, Huffman::SYMBOL_SIZE);
+        }
+        size_t current_len = 1;
+        size_t len_count = 0;
+        for (size_t i = 0; i < symbols_count; ++i) {
+            while (char_codelen[i].first > current_len) {
+                writer.Write(len_count, Huffman::SYMBOL_SIZE);
+                len_count = 0;
+                ++current_len;
+            }
+            ++len_count;
+        }
+        writer.Write(len_count, Huffman::SYMBOL_SIZE);
+    }
+
+    std::vector<std::pair<size_t, Letter>> ReadCodeLengths(BitReader& reader) {
+        size_t symbols_count = reader.Read(Huffman::SYMBOL_SIZE);
+        if (symbols_count == 0 || symbols_count > Huffman::SYMBOLS_COUNT) {
+            throw std::runtime_error("ReadCodeLengths: Malformed code table.");
+        }
+        std::vector<std::pair<size_t, Letter>> char_codelen;
+        for (size_t i = 0; i < symbols_count; ++i) {
+            char_codelen.push_back({ 0, reader.Read(Huffman::SYMBOL_SIZE) });
+        }
+        std::vector<size_t> len_count;
+        size_t len_sum = 0;
+        while (len_sum < symbols_count) {
+            if (len_count.size() == Huffman::MAX_CODE_LENGTH) {
+                throw std::runtime_error("ReadCodeLengths: Malformed code table.");
+            }
+            len_count.push_back(reader.Read(Huffman::SYMBOL_SIZE));
+            len_sum += len_count.back();
+        }
+        if (len_sum != symbols_count) {
+            throw std::runtime_error("ReadCodeLengths: Malformed code table.");
+        }
+        size_t char_index = 0;
+        for (size_t i = 0; i < len_count.size(); ++i) {
+            for (size_t j = 0; j < len_count[i]; ++j) {
+                char_codelen[char_index].first = i + 1;
+                ++char_index;
+            }
+        }
+        return char_codelen;
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bitstream.h"
+#include "decodetable.h"
+#include "huffman_constants.h"
+#include "huffmantree.h"
+#include "payloadbuffer.h"
+#include "presets.h"
+#include "stats.h"
+
+namespace Huffman {
+    enum class BlockType : uint8_t {
+        HUFFMAN = 0,
+        HUFFMAN_X4 = 1,
+        HUFFMAN_SHARED = 2,
+        HUFFMAN_SHARED_X4 = 3,
+        STORED = 4,
+        HUFFMAN_CONTEXT = 5,
+        PRESET = 6,
+        HUFFMAN_SAMPLED = 7,
+        HUFFMAN_SAMPLED_X4 = 8,
+    };
+
+    // Blocks shorter than this are never coded with the order-1 context model.
+    const size_t CONTEXT_MIN_BLOCK_SIZE = 1 << 12;
+    const size_t CONTEXT_COUNT = 256;
+
+    // Blocks of at least this many bytes are split into interleaved sub-streams unless disabled.
+    const size_t INTERLEAVED_MIN_BLOCK_SIZE = 1 << 14;
+    const size_t INTERLEAVED_STREAM_COUNT = 4;
+    const size_t INTERLEAVED_SIZE_BITS = 32;
+
+    // A sampled block builds its table from its first SAMPLE_HEAD_SIZE bytes and SAMPLE_CHUNK_COUNT
+    // chunks of SAMPLE_CHUNK_SIZE bytes spread evenly over the rest. Bytes missing from the sample are
+    // coded as SAMPLE_ESCAPE followed by the byte itself in BYTE_SIZE bits.
+    const size_t SAMPLE_HEAD_SIZE = 1 << 14;
+    const size_t SAMPLE_CHUNK_SIZE = 1 << 9;
+    const size_t SAMPLE_CHUNK_COUNT = 96;
+    const Letter SAMPLE_ESCAPE = 256;
+
+    // One independently coded piece of a member. A HUFFMAN payload holds the code lengths
+    // (see WriteCodeLengths) followed by the codes of raw_size bytes.
+    // A HUFFMAN_X4 payload holds the code lengths, the byte sizes of the first three sub-streams
+    // (INTERLEAVED_SIZE_BITS each), padding to a whole byte, and the four sub-streams. Byte i of the
+    // block is coded in sub-stream i % 4, so a decoder can follow four independent bit cursors.
+    // HUFFMAN_SHARED and HUFFMAN_SHARED_X4 payloads are laid out the same way without the code lengths;
+    // their codes come from a table shared by many blocks (see BuildSharedTable).
+    // A STORED payload is the raw bytes themselves, used when no code would make the block smaller.
+    // A HUFFMAN_CONTEXT payload codes every byte with a table chosen by the byte before it (0 before the
+    // first one). It holds CONTEXT_COUNT bits telling which previous bytes have a table of their own, one
+    // bit telling whether a fallback table for all other contexts follows, the code lengths of the own
+    // tables in order of the previous byte, those of the fallback table, and then the codes.
+    // A PRESET payload holds the Preset ID (PRESET_ID_BITS) followed by the codes of that built-in table.
+    // HUFFMAN_SAMPLED and HUFFMAN_SAMPLED_X4 payloads are laid out as HUFFMAN and HUFFMAN_X4, but their
+    // code lengths may include SAMPLE_ESCAPE.
+    struct EncodedBlock {
+        BlockType type;
+        size_t raw_size;
+        size_t bit_count;
+        std::vector<char> payload;
+        // Payload bits added by BlockOptions::max_code_length over an unrestricted Huffman code.
+        size_t length_limit_cost;
+    };
+
+    struct BlockOptions {
+        size_t max_code_length = MAX_CODE_LENGTH;
+        bool interleave = true;
+        // Try the order-1 context model and use it for blocks where it beats a single table.
+        bool context_model = false;
+        // A preset codes every block in one pass without a histogram; AUTO lets blocks also choose one.
+        // Presets are not used when max_code_length is below PRESET_MAX_CODE_LENGTH.
+        Preset preset = Preset::NONE;
+        // Build the code of every block longer than its sample from that sample instead of counting all
+        // its bytes first. Sampled blocks do not consider the shared table, AUTO presets or the context model.
+        bool sample = false;
+    };
+
+    // An encoded block whose payload is stored elsewhere, e.g. in a caller's buffer.
+    struct BlockView {
+        BlockType type;
+        size_t raw_size;
+        size_t bit_count;
+        const char* payload;
+        size_t payload_size;
+    };
+
+    // Phase timings and code statistics go to stats when it is not null. With a shared_table the block is
+    // coded with it whenever that is no larger than carrying a code table of its own.
+    EncodedBlock EncodeBlock(const unsigned char* data, size_t size, const BlockOptions& options = {}, BlockStats* stats = nullptr,
+        const HuffmanTree::CodeTable* shared_table = nullptr);
+    // The same, but the payload is written to payload, e.g. a caller's buffer, and the returned block has
+    // none. A payload that overflows a caller's buffer is stored raw; throws PayloadOverflow if that does
+    // not fit either.
+    EncodedBlock EncodeBlock(PayloadBuffer& payload, const unsigned char* data, size_t size, const BlockOptions& options = {},
+        BlockStats* stats = nullptr, const HuffmanTree::CodeTable* shared_table = nullptr);
+    // Writes block.raw_size decoded bytes to out. Blocks coded with a shared table need its decoder.
+    void DecodeBlock(const EncodedBlock& block, unsigned char* out, BlockStats* stats = nullptr, const DecodeTable* shared_table = nullptr);
+    void DecodeBlock(const BlockView& block, unsigned char* out, BlockStats* stats = nullptr, const DecodeTable* shared_table = nullptr);
+
+    // Code table for data whose byte counts are char_count; every byte value gets a code, so the table
+    // can code any block.
+    HuffmanTree::CodeTable BuildSharedTable(std::vector<size_t> char_count, const BlockOptions& options = {});
+    // Reads a table written with WriteCodeLengths by BuildSharedTable's user.
+    DecodeTable ReadSharedTable(BitReader& reader);
+
+    // Code length header shared by all format versions: the symbol count, the symbols in canonical order,
+    // and the number of codes of every length from 1 up to the longest one, each SYMBOL_SIZE bits wide.
+    void WriteCodeLengths(BitWriter& writer, const HuffmanTree::CodeTable& encoded_chars);
+    std::vector<std::pair<size_t, Letter>> ReadCodeLengths(BitReader& reader);
+}
@@ -1,153 +1,859 @@
 #include "coder.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
 #include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "hash.h"
+#include "histogram.h"
 
 namespace Huffman {
-    Encoder::Encoder(std::ostream& out) : writer_(out) {
-        first_file_ = true;
+    namespace {
+        const size_t MAX_BLOCK_SIZE = 1 << 26;
+        // Longest code of a byte: an escape of a sampled block followed by the byte itself.
+        const size_t MAX_BYTE_CODE_BITS = MAX_CODE_LENGTH + BYTE_SIZE;
+        // Payload bits besides the codes: the flags and up to one table per context and a fallback table of
+        // a HUFFMAN_CONTEXT block, or the stream sizes and padding of an interleaved one.
+        const size_t MAX_BLOCK_HEADER_BITS = CONTEXT_COUNT + 1 + (CONTEXT_COUNT + 1) * SYMBOL_SIZE * (1 + SYMBOLS_COUNT + MAX_CODE_LENGTH)
+            + INTERLEAVED_STREAM_COUNT * (INTERLEAVED_SIZE_BITS + BYTE_SIZE);
+    }
+
+    Encoder::Encoder(std::ostream& out, size_t thread_count, const BlockOptions& block_options)
+        : out_(out), output_buffer_(out.rdbuf()), output_(&output_buffer_), writer_(output_) {
+        Initialize(thread_count, block_options);
+        writer_.WriteBytes(ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+        writer_.WriteByte(FORMAT_VERSION);
+    }
+
+    Encoder::Encoder(std::ostream& out, const std::vector<MemberInfo>& members, uint64_t index_offset, size_t thread_count,
+        const BlockOptions& block_options)
+        : out_(out), output_buffer_(out.rdbuf()), output_(&output_buffer_), writer_(output_, index_offset) {
+        Initialize(thread_count, block_options);
+        members_ = members;
+        kept_member_count_ = members.size();
+        member_count_ = members.size();
+        appending_ = true;
+        complete_member_count_ = members.size();
+        complete_offset_ = index_offset;
     }
 
     Encoder::~Encoder() {
-        if (!first_file_) {
-            writer_.Write(archive_end_code_, archive_end_code_.size());
+        if (!failed_) {
+            FinishMember();
+            WriteIndex();
+        } else if (appending_ && output_.flush()) {
+            // The old index is gone, so the members written in full get a new one in place of whatever followed them.
+            out_.seekp(complete_offset_);
+            members_.resize(complete_member_count_);
+            writer_ = ByteWriter(output_, complete_offset_);
+            WriteIndex();
+        }
+        if (!output_.flush()) {
+            out_.setstate(std::ios::badbit);
+        }
+    }
+
+    void Encoder::EncodeFile(const InputSource& source, const std::string& file_name) {
+        try {
+            // The caller owns source; all its blocks are written before returning.
+            SubmitMember(std::shared_ptr<const InputSource>(&source, [](const InputSource*) {}), file_name);
+            WritePending(0);
+        } catch (...) {
+            Abort();
+            throw;
+        }
+    }
+
+    void Encoder::EncodeStream(std::istream& in, const std::string& file_name) {
+        try {
+            SubmitStream(in, file_name);
+            WritePending(0);
+        } catch (...) {
+            Abort();
+            throw;
+        }
+    }
+
+    void Encoder::EncodeFiles(const std::vector<std::string>& file_names) {
+        try {
+            for (const auto& file_name : file_names) {
+                if (file_name == "-") {
+                    SubmitStream(std::cin, file_name);
+                    continue;
+                }
+                PhaseTimer timer(stats_ != nullptr);
+                auto source = std::make_unique<InputSource>(file_name);
+                size_t original;
+                bool duplicate = deduplicate_ && FindDuplicate(*source, file_name, original);
+                // Opening, hashing and comparing with earlier files all count as reading the input.
+                double open_seconds = timer.Lap();
+                if (duplicate) {
+                    SubmitDuplicate(file_name, original);
+                } else {
+                    SubmitMember(std::move(source), file_name);
+                }
+                if (stats_ != nullptr) {
+                    stats_->members.back().blocks.io_seconds += open_seconds;
+                }
+            }
+            WritePending(0);
+        } catch (...) {
+            Abort();
+            throw;
+        }
+    }
+
+    void Encoder::WriteSharedTable(const std::vector<std::string>& file_names) {
+        try {
+            std::vector<size_t> char_count(SYMBOLS_COUNT);
+            for (const auto& file_name : file_names) {
+                if (file_name == "-") {
+                    continue;
+                }
+                InputSource source(file_name);
+                std::vector<size_t> file_count = CountBytes(source.Data(), source.Size());
+                for (size_t i = 0; i < SYMBOLS_COUNT; ++i) {
+                    char_count[i] += file_count[i];
+                }
+            }
+            shared_table_ = std::make_shared<HuffmanTree::CodeTable>(BuildSharedTable(char_count, block_options_));
+            WritePending(0);
+            FinishMember();
+            std::vector<char> payload;
+            size_t bit_count;
+            {
+                BitWriter writer(payload);
+                WriteCodeLengths(writer, *shared_table_);
+                bit_count = writer.BitCount();
+            }
+            table_offset_ = writer_.Offset();
+            writer_.WriteByte(RECORD_TABLE);
+            writer_.WriteVarint(bit_count);
+            writer_.WriteBytes(payload.data(), payload.size());
+        } catch (...) {
+            Abort();
+            throw;
         }
     }
 
-    void Encoder::EncodeFile(std::istream& in, const std::string file_name) {
-        std::vector<size_t> char_count = GetCharCount(in, file_name);
+    void Encoder::SetStats(ArchiveStats* stats) {
+        stats_ = stats;
+    }
 
-        HuffmanTree tree;
-        std::vector<HuffmanTree::EncodedChar> encoded_chars = tree.GetEncodedChars(char_count);
+    void Encoder::SetDeduplication(bool enabled) {
+        deduplicate_ = enabled;
+    }
+
+    uint64_t Encoder::PayloadBits() const {
+        return payload_bits_;
+    }
+
+    uint64_t Encoder::LengthLimitBits() const {
+        return length_limit_bits_;
+    }
 
-        WriteOutput(encoded_chars, file_name);
+    void Encoder::Initialize(size_t thread_count, const BlockOptions& block_options) {
+        thread_count_ = std::max<size_t>(thread_count, 1);
+        block_options_ = block_options;
+        pool_ = std::make_unique<ThreadPool>(thread_count_);
+        kept_member_count_ = 0;
+        appending_ = false;
+        complete_member_count_ = 0;
+        complete_offset_ = 0;
+        failed_ = false;
+        stats_ = nullptr;
+        payload_bits_ = 0;
+        length_limit_bits_ = 0;
+        table_offset_ = 0;
+        deduplicate_ = false;
+        member_count_ = 0;
     }
 
-    std::vector<size_t> Encoder::GetCharCount(std::istream& in, const std::string file_name) const {
-        std::vector<size_t> char_count(Huffman::SYMBOLS_COUNT, 0);
-        for (auto char_value : file_name) {
-            ++char_count[static_cast<unsigned char>(char_value)];
+    void Encoder::Abort() {
+        failed_ = true;
+        // An append keeps the members submitted before the failure that can still be written in full.
+        if (appending_) {
+            try {
+                WritePending(0);
+            } catch (...) {
+            }
         }
-        BitReader reader(in);
-        Letter char_value = reader.Read();
-        while (!reader.EndOfStream()) {
-            ++char_count[char_value];
-            char_value = reader.Read();
+        for (auto& record : pending_) {
+            if (record.block.valid()) {
+                record.block.wait();
+            }
         }
-        ++char_count[Huffman::FILENAME_END];
-        ++char_count[Huffman::ONE_MORE_FILE];
-        ++char_count[Huffman::ARCHIVE_END];
-        return char_count;
+        pending_.clear();
     }
 
-    void Encoder::WriteOutput(const std::vector<HuffmanTree::EncodedChar>& encoded_chars, const std::string& file_name) {
-        if (!first_file_) {
-            writer_.Write(one_more_file_code_, one_more_file_code_.size());
+    MemberStats& Encoder::CurrentMemberStats() {
+        return stats_->members[members_.size() - 1 - kept_member_count_];
+    }
+
+    void Encoder::SubmitMember(std::shared_ptr<const InputSource> source, const std::string& file_name) {
+        ++member_count_;
+        pending_.push_back({ true, file_name, {}, nullptr, nullptr });
+        if (stats_ != nullptr) {
+            stats_->members.push_back({ file_name });
+        }
+        for (size_t offset = 0; offset < source->Size(); offset += BLOCK_SIZE) {
+            // At most two blocks per thread wait in memory for their turn to be written.
+            WritePending(2 * thread_count_ - 1);
+            size_t size = std::min(BLOCK_SIZE, source->Size() - offset);
+            auto block_stats = stats_ != nullptr ? std::make_shared<BlockStats>() : nullptr;
+            auto task = [source, offset, size, options = block_options_, block_stats, table = shared_table_]() {
+                return EncodeBlock(source->Data() + offset, size, options, block_stats.get(), table.get());
+            };
+            pending_.push_back({ false, std::string(), SubmitTo(pool_.get(), task), block_stats, nullptr });
         }
+        pending_.back().completes_member = true;
+    }
 
-        size_t symbols_count = encoded_chars.size();
-        std::vector<const HuffmanTree::EncodedChar*> char_ptrs(Huffman::SYMBOLS_COUNT, nullptr);
-        for (const auto& encoded_char : encoded_chars) {
-            char_ptrs[encoded_char.char_value] = &encoded_char;
+    void Encoder::SubmitStream(std::istream& in, const std::string& file_name) {
+        ++member_count_;
+        pending_.push_back({ true, file_name, {}, nullptr, nullptr });
+        if (stats_ != nullptr) {
+            stats_->members.push_back({ file_name });
+        }
+        while (in) {
+            // The window is drained before the next block is read, so memory use does not grow with
+            // the length of the stream.
+            WritePending(2 * thread_count_ - 1);
+            // Left uninitialized: short streams only touch the pages they fill.
+            std::shared_ptr<char[]> buffer;
+            if (free_buffers_.empty()) {
+                buffer.reset(new char[BLOCK_SIZE]);
+            } else {
+                buffer = std::move(free_buffers_.back());
+                free_buffers_.pop_back();
+            }
+            PhaseTimer timer(stats_ != nullptr);
+            in.read(buffer.get(), BLOCK_SIZE);
+            size_t size = in.gcount();
+            if (stats_ != nullptr) {
+                stats_->members.back().blocks.io_seconds += timer.Lap();
+            }
+            if (size == 0) {
+                break;
+            }
+            auto block_stats = stats_ != nullptr ? std::make_shared<BlockStats>() : nullptr;
+            auto task = [buffer, size, options = block_options_, block_stats, table = shared_table_]() {
+                return EncodeBlock(reinterpret_cast<const unsigned char*>(buffer.get()), size, options, block_stats.get(), table.get());
+            };
+            pending_.push_back({ false, std::string(), SubmitTo(pool_.get(), task), block_stats, buffer });
         }
+        if (in.bad()) {
+            throw std::runtime_error("Encoder: Cannot read file " + file_name + ".");
+        }
+        pending_.back().completes_member = true;
+    }
+
+    void Encoder::SubmitDuplicate(const std::string& file_name, size_t original) {
+        ++member_count_;
+        pending_.push_back({ true, file_name, {}, nullptr, nullptr, original, true });
+        if (stats_ != nullptr) {
+            stats_->members.push_back({ file_name });
+        }
+    }
 
-        writer_.Write(symbols_count, Huffman::SYMBOL_SIZE);
-        for (size_t i = 0; i < symbols_count; ++i) {
-            writer_.Write(encoded_chars[i].char_value, Huffman::SYMBOL_SIZE);
+    bool Encoder::FindDuplicate(const InputSource& source, const std::string& file_name, size_t& original) {
+        // An empty member takes no more room than a reference to another one.
+        if (source.Size() == 0) {
+            return false;
         }
-        size_t current_len = 1;
-        size_t len_count = 0;
-        for (size_t i = 0; i < symbols_count; ++i) {
-            while (encoded_chars[i].codelen > current_len) {
-                writer_.Write(len_count, Huffman::SYMBOL_SIZE);
-                len_count = 0;
-                ++current_len;
+        auto& candidates = dedup_candidates_[source.Size()];
+        uint64_t hash = candidates.empty() ? 0 : HashBytes(source.Data(), source.Size());
+        for (auto& candidate : candidates) {
+            // A candidate opened for its hash is compared through the same mapping.
+            std::optional<InputSource> candidate_source;
+            if (!candidate.hashed) {
+                candidate_source.emplace(candidate.file_name);
+                candidate.hash = HashBytes(candidate_source->Data(), candidate_source->Size());
+                candidate.hashed = true;
+            }
+            if (candidate.hash != hash) {
+                continue;
+            }
+            if (!candidate_source) {
+                candidate_source.emplace(candidate.file_name);
+            }
+            if (candidate_source->Size() == source.Size() && std::memcmp(candidate_source->Data(), source.Data(), source.Size()) == 0) {
+                original = candidate.member;
+                return true;
             }
-            ++len_count;
         }
-        writer_.Write(len_count, Huffman::SYMBOL_SIZE);
-        for (auto char_value : file_name) {
-            writer_.Write(char_ptrs[static_cast<unsigned char>(char_value)]->code, char_ptrs[static_cast<unsigned char>(char_value)]->codelen);
+        candidates.push_back({ file_name, member_count_, !candidates.empty(), hash });
+        return false;
+    }
+
+    void Encoder::WritePending(size_t max_pending) {
+        while (pending_.size() > max_pending) {
+            WriteRecord(pending_.front());
+            if (pending_.front().completes_member) {
+                FinishMember();
+                complete_member_count_ = members_.size();
+                complete_offset_ = writer_.Offset();
+            }
+            // The coding task may still hold the window for a moment; then a new one is allocated later.
+            if (pending_.front().buffer != nullptr && pending_.front().buffer.use_count() == 1) {
+                free_buffers_.push_back(std::move(pending_.front().buffer));
+            }
+            pending_.pop_front();
+        }
+    }
+
+    void Encoder::WriteRecord(PendingRecord& record) {
+        if (record.is_member && record.original != SIZE_MAX) {
+            FinishMember();
+            // The original's records are all written, so its offset and size are known.
+            MemberInfo original = members_[record.original];
+            members_.push_back({ record.file_name, original.size, writer_.Offset(), 0, 0 });
+            writer_.WriteByte(RECORD_DUPLICATE);
+            writer_.WriteString(record.file_name);
+            writer_.WriteVarint(original.offset);
+            if (stats_ != nullptr) {
+                CurrentMemberStats().bytes_in += original.size;
+                CurrentMemberStats().bytes_out += writer_.Offset() - members_.back().offset;
+            }
+            return;
         }
-        writer_.Write(char_ptrs[Huffman::FILENAME_END]->code, char_ptrs[Huffman::FILENAME_END]->codelen);
-        std::ifstream in(file_name, std::ios::binary);
-        BitReader reader(in);
-        Letter read_char = reader.Read(Huffman::BYTE_SIZE);
-        while (!reader.EndOfStream()) {
-            writer_.Write(char_ptrs[read_char]->code, char_ptrs[read_char]->codelen);
-            read_char = reader.Read(Huffman::BYTE_SIZE);
+        if (record.is_member) {
+            FinishMember();
+            members_.push_back({ record.file_name, 0, writer_.Offset(), 0, table_offset_ });
+            writer_.WriteByte(RECORD_MEMBER);
+            writer_.WriteString(record.file_name);
+            if (stats_ != nullptr) {
+                CurrentMemberStats().bytes_out += writer_.Offset() - members_.back().offset;
+            }
+            return;
+        }
+        EncodedBlock block = record.block.get();
+        uint64_t record_offset = writer_.Offset();
+        PhaseTimer timer(record.stats != nullptr);
+        members_.back().size += block.raw_size;
+        payload_bits_ += block.bit_count;
+        length_limit_bits_ += block.length_limit_cost;
+        writer_.WriteByte(RECORD_BLOCK);
+        writer_.WriteByte(static_cast<uint8_t>(block.type));
+        writer_.WriteVarint(block.raw_size);
+        writer_.WriteVarint(block.bit_count);
+        writer_.WriteBytes(block.payload.data(), block.payload.size());
+        if (record.stats != nullptr) {
+            record.stats->io_seconds += timer.Lap();
+            MemberStats& member_stats = CurrentMemberStats();
+            member_stats.Add(*record.stats);
+            member_stats.bytes_in += block.raw_size;
+            member_stats.bytes_out += writer_.Offset() - record_offset;
         }
-        in.close();
+    }
 
-        one_more_file_code_ = char_ptrs[Huffman::ONE_MORE_FILE]->code;
-        archive_end_code_ = char_ptrs[Huffman::ARCHIVE_END]->code;
-        first_file_ = false;
+    void Encoder::FinishMember() {
+        if (members_.size() > kept_member_count_) {
+            members_.back().packed_size = writer_.Offset() - members_.back().offset;
+        }
     }
 
-    Decoder::Decoder(std::istream& in) : reader_(in) {
+    void Encoder::WriteIndex() {
+        uint64_t index_offset = writer_.Offset();
+        writer_.WriteByte(RECORD_INDEX);
+        writer_.WriteVarint(members_.size());
+        for (const auto& member : members_) {
+            writer_.WriteString(member.name);
+            writer_.WriteVarint(member.size);
+            writer_.WriteVarint(member.offset);
+            writer_.WriteVarint(member.packed_size);
+            writer_.WriteVarint(member.table_offset);
+        }
+        writer_.WriteUint64(index_offset);
+        writer_.WriteBytes(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    }
+
+    Decoder::Decoder(std::istream& in, size_t thread_count) : in_(in) {
+        thread_count_ = std::max<size_t>(thread_count, 1);
+        stats_ = nullptr;
+        pool_ = std::make_unique<ThreadPool>(thread_count_);
+        writer_pool_ = std::make_unique<ThreadPool>(1);
     }
 
     void Decoder::DecodeFiles() {
-        bool one_more_file = true;
-        while (one_more_file) {
-            one_more_file = DecodeFile();
+        if (!ReadHeader()) {
+            DecodeLegacyFiles(nullptr);
+            return;
         }
+        uint64_t index_offset = 0;
+        std::vector<MemberInfo> members = ReadIndex(&index_offset);
+        in_.seekg(ARCHIVE_MAGIC_SIZE + 1);
+        ByteReader reader(in_, ARCHIVE_MAGIC_SIZE + 1);
+        extracted_.clear();
+        DecodeRecords(reader, index_offset, members);
     }
 
-    bool Decoder::WriteFile(HuffmanTree& tree) {
-        std::string output_file;
+    void Decoder::DecodeFiles(const std::vector<std::string>& file_names) {
+        std::set<std::string> selected(file_names.begin(), file_names.end());
+        std::vector<MemberInfo> members;
+        bool legacy = !ReadHeader();
+        if (legacy) {
+            members = DecodeLegacyFiles(&selected);
+        } else {
+            members = ReadIndex();
+        }
+
+        std::set<std::string> missing = selected;
+        for (const auto& member : members) {
+            missing.erase(member.name);
+        }
+        if (!missing.empty()) {
+            throw std::runtime_error("Decoder: No member " + *missing.begin() + " in archive.");
+        }
+        if (legacy) {
+            return;
+        }
+        extracted_.clear();
+        for (const auto& member : members) {
+            if (selected.count(member.name) > 0) {
+                ReadMemberTable(member);
+                in_.clear();
+                in_.seekg(member.offset);
+                ByteReader reader(in_, member.offset);
+                DecodeRecords(reader, member.offset + member.packed_size, members);
+            }
+        }
+    }
+
+    std::vector<MemberInfo> Decoder::ListFiles() {
+        if (!ReadHeader()) {
+            std::set<std::string> nothing;
+            return DecodeLegacyFiles(&nothing);
+        }
+        return ReadIndex();
+    }
+
+    std::vector<MemberInfo> Decoder::ListFiles(uint64_t& index_offset) {
+        if (!ReadHeader()) {
+            throw std::runtime_error("Decoder: Only version 2 archives can be appended to.");
+        }
+        return ReadIndex(&index_offset);
+    }
+
+    void Decoder::SetStats(ArchiveStats* stats) {
+        stats_ = stats;
+    }
+
+    void Decoder::DecodeStream(std::ostream& out) {
+        if (!ReadVersionHeader()) {
+            throw std::runtime_error("Decoder: Only version 2 archives can be read from a stream.");
+        }
+        // Writes go through a writer thread so that out never stalls reading and decoding.
+        AsyncOutputBuffer output_buffer(out.rdbuf());
+        std::ostream output(&output_buffer);
+        struct PendingData {
+            std::future<std::vector<char>> data;
+            size_t member;
+            std::shared_ptr<BlockStats> stats;
+        };
+        std::deque<PendingData> pending;
+        auto write_front = [&]() {
+            std::vector<char> data = pending.front().data.get();
+            PhaseTimer timer(stats_ != nullptr);
+            output.write(data.data(), data.size());
+            if (stats_ != nullptr) {
+                pending.front().stats->io_seconds += timer.Lap();
+                AddBlockStats(pending.front().member, *pending.front().stats);
+            }
+            pending.pop_front();
+        };
+
+        auto submit_block = [&](ByteReader& reader, uint64_t record_offset, uint64_t end_offset, PhaseTimer& timer,
+            std::shared_ptr<const DecodeTable> table) {
+            auto block = std::make_shared<EncodedBlock>(ReadBlock(reader, end_offset));
+            auto block_stats = stats_ != nullptr ? std::make_shared<BlockStats>() : nullptr;
+            if (block_stats != nullptr) {
+                block_stats->io_seconds = timer.Lap();
+                stats_->members.back().bytes_in += reader.Offset() - record_offset;
+            }
+            auto task = [block, block_stats, table]() {
+                std::vector<char> data(block->raw_size);
+                DecodeBlock(*block, reinterpret_cast<unsigned char*>(data.data()), block_stats.get(), table.get());
+                return data;
+            };
+            size_t member = stats_ != nullptr ? stats_->members.size() - 1 : 0;
+            pending.push_back({ SubmitTo(pool_.get(), task), member, block_stats });
+            while (pending.size() >= 2 * thread_count_) {
+                write_front();
+            }
+        };
+        // Members read so far by offset, with the end of their records and the table of their blocks,
+        // so that a duplicate can read its original again if in_ can seek.
+        struct ReadMember {
+            uint64_t end_offset;
+            std::shared_ptr<const DecodeTable> table;
+        };
+        std::unordered_map<uint64_t, ReadMember> read_members;
+        uint64_t current_member = UINT64_MAX;
+
+        ByteReader reader(in_, ARCHIVE_MAGIC_SIZE + 1);
+        bool has_member = false;
         while (true) {
-            auto opt_char = tree.NextNode(reader_.Read(1));
-            if (opt_char.has_value()) {
-                if (opt_char.value() == Huffman::FILENAME_END) {
-                    break;
+            uint64_t record_offset = reader.Offset();
+            PhaseTimer timer(stats_ != nullptr);
+            uint8_t record_type = reader.ReadByte();
+            if (record_type != RECORD_BLOCK && current_member != UINT64_MAX) {
+                read_members[current_member].end_offset = record_offset;
+                current_member = UINT64_MAX;
+            }
+            if (record_type == RECORD_INDEX) {
+                break;
+            }
+            if (record_type == RECORD_MEMBER) {
+                std::string file_name = reader.ReadString();
+                has_member = true;
+                current_member = record_offset;
+                read_members[record_offset] = { 0, shared_table_ };
+                StartMemberStats(file_name, reader.Offset() - record_offset);
+            } else if (record_type == RECORD_DUPLICATE) {
+                std::string file_name = reader.ReadString();
+                uint64_t original_offset = reader.ReadVarint();
+                auto original = read_members.find(original_offset);
+                if (original == read_members.end()) {
+                    throw std::runtime_error("Decoder: Malformed archive.");
                 }
-                output_file += static_cast<char>(opt_char.value());
+                has_member = false;
+                StartMemberStats(file_name, reader.Offset() - record_offset);
+                uint64_t resume_offset = reader.Offset();
+                in_.clear();
+                if (!in_.seekg(original_offset)) {
+                    throw std::runtime_error("Decoder: Archives with duplicate members can only be read from a seekable stream.");
+                }
+                ByteReader original_reader(in_, original_offset);
+                original_reader.ReadByte();
+                original_reader.ReadString();
+                while (original_reader.Offset() < original->second.end_offset) {
+                    uint64_t block_offset = original_reader.Offset();
+                    if (original_reader.ReadByte() != RECORD_BLOCK) {
+                        throw std::runtime_error("Decoder: Malformed archive.");
+                    }
+                    submit_block(original_reader, block_offset, original->second.end_offset, timer, original->second.table);
+                }
+                in_.seekg(resume_offset);
+            } else if (record_type == RECORD_TABLE) {
+                ReadSharedTable(reader);
+            } else if (record_type == RECORD_BLOCK && has_member) {
+                submit_block(reader, record_offset, UINT64_MAX, timer, shared_table_);
+            } else {
+                throw std::runtime_error("Decoder: Malformed archive.");
             }
         }
-        std::ofstream out(output_file, std::ios::binary);
-        BitWriter writer(out);
+        while (!pending.empty()) {
+            write_front();
+        }
+        if (!output.flush() || !out.flush()) {
+            throw std::runtime_error("Decoder: Cannot write output.");
+        }
+    }
 
-        bool one_more_file = false;
-        while (true) {
-            auto opt_char = tree.NextNode(reader_.Read(1));
-            if (opt_char.has_value()) {
-                if (opt_char.value() == Huffman::ONE_MORE_FILE) {
-                    one_more_file = true;
-                    break;
+    bool Decoder::ReadHeader() {
+        in_.clear();
+        in_.seekg(0);
+        if (!ReadVersionHeader()) {
+            in_.clear();
+            in_.seekg(0);
+            return false;
+        }
+        return true;
+    }
+
+    bool Decoder::ReadVersionHeader() {
+        char magic[ARCHIVE_MAGIC_SIZE];
+        in_.read(magic, ARCHIVE_MAGIC_SIZE);
+        if (static_cast<size_t>(in_.gcount()) != ARCHIVE_MAGIC_SIZE || !std::equal(magic, magic + ARCHIVE_MAGIC_SIZE, ARCHIVE_MAGIC)) {
+            return false;
+        }
+        ByteReader reader(in_, ARCHIVE_MAGIC_SIZE);
+        if (reader.ReadByte() != FORMAT_VERSION) {
+            throw std::runtime_error("Decoder: Unsupported archive version.");
+        }
+        return true;
+    }
+
+    std::vector<MemberInfo> Decoder::ReadIndex(uint64_t* index_offset_out) {
+        in_.clear();
+        in_.seekg(0, std::ios::end);
+        uint64_t archive_size = in_.tellg();
+        if (!in_ || archive_size < ARCHIVE_MAGIC_SIZE + 1 + TRAILER_SIZE) {
+            throw std::runtime_error("Decoder: Archive has no index.");
+        }
+        in_.seekg(archive_size - TRAILER_SIZE);
+        ByteReader trailer(in_, archive_size - TRAILER_SIZE);
+        uint64_t index_offset = trailer.ReadUint64();
+        char magic[sizeof(INDEX_MAGIC)];
+        trailer.ReadBytes(magic, sizeof(magic));
+        if (!std::equal(magic, magic + sizeof(magic), INDEX_MAGIC) || index_offset >= archive_size - TRAILER_SIZE) {
+            throw std::runtime_error("Decoder: Archive has no index.");
+        }
+
+        in_.seekg(index_offset);
+        ByteReader reader(in_, index_offset);
+        if (reader.ReadByte() != RECORD_INDEX) {
+            throw std::runtime_error("Decoder: Malformed archive index.");
+        }
+        uint64_t member_count = reader.ReadVarint();
+        if (member_count > archive_size) {
+            throw std::runtime_error("Decoder: Malformed archive index.");
+        }
+        std::vector<MemberInfo> members;
+        for (uint64_t i = 0; i < member_count; ++i) {
+            MemberInfo member;
+            member.name = reader.ReadString();
+            member.size = reader.ReadVarint();
+            member.offset = reader.ReadVarint();
+            member.packed_size = reader.ReadVarint();
+            member.table_offset = reader.ReadVarint();
+            if (member.offset > index_offset || member.packed_size > index_offset - member.offset) {
+                throw std::runtime_error("Decoder: Malformed archive index.");
+            }
+            members.push_back(member);
+        }
+        if (index_offset_out != nullptr) {
+            *index_offset_out = index_offset;
+        }
+        return members;
+    }
+
+    void Decoder::DecodeRecords(ByteReader& reader, uint64_t end_offset, const std::vector<MemberInfo>& members,
+        const std::string* file_name) {
+        std::unordered_map<uint64_t, const MemberInfo*> members_at;
+        for (const auto& member : members) {
+            members_at[member.offset] = &member;
+        }
+        try {
+            std::shared_ptr<OutputFile> out;
+            uint64_t out_offset = 0;
+            // Queued on the writer thread behind the blocks of the member, so that an error reported by close()
+            // fails the extraction like a failed write.
+            auto close_out = [&]() {
+                if (out != nullptr) {
+                    pending_.push_back({ SubmitTo(writer_pool_.get(), [out]() { out->Close(); }), 0, nullptr });
+                    out = nullptr;
                 }
-                if (opt_char.value() == Huffman::ARCHIVE_END) {
+            };
+            while (reader.Offset() < end_offset) {
+                uint64_t record_offset = reader.Offset();
+                uint8_t record_type = reader.ReadByte();
+                if (record_type == RECORD_INDEX) {
                     break;
                 }
-                writer.Write(opt_char.value());
+                if (record_type == RECORD_MEMBER) {
+                    std::string member_name = reader.ReadString();
+                    if (file_name != nullptr) {
+                        member_name = *file_name;
+                    }
+                    auto member = members_at.find(record_offset);
+                    close_out();
+                    out = std::make_shared<OutputFile>(member_name, member != members_at.end() ? member->second->size : 0);
+                    out_offset = 0;
+                    extracted_[member_name] = record_offset;
+                    StartMemberStats(member_name, reader.Offset() - record_offset);
+                } else if (record_type == RECORD_DUPLICATE && file_name == nullptr) {
+                    std::string member_name = reader.ReadString();
+                    auto original = members_at.find(reader.ReadVarint());
+                    if (original == members_at.end() || original->second->offset >= record_offset) {
+                        throw std::runtime_error("Decoder: Malformed archive.");
+                    }
+                    close_out();
+                    DecodeDuplicate(member_name, *original->second, reader.Offset() - record_offset, members);
+                    in_.clear();
+                    in_.seekg(reader.Offset());
+                } else if (record_type == RECORD_TABLE) {
+                    ReadSharedTable(reader);
+                } else if (record_type == RECORD_BLOCK && out) {
+                    // Every block knows its place in the output, so blocks of different members are decoded side
+                    // by side; the writer thread stores each one as soon as it is ready.
+                    PhaseTimer timer(stats_ != nullptr);
+                    auto block = std::make_shared<EncodedBlock>(ReadBlock(reader, end_offset));
+                    auto block_stats = stats_ != nullptr ? std::make_shared<BlockStats>() : nullptr;
+                    if (block_stats != nullptr) {
+                        block_stats->io_seconds = timer.Lap();
+                        stats_->members.back().bytes_in += reader.Offset() - record_offset;
+                    }
+                    auto decode = [block, block_stats, table = shared_table_]() {
+                        std::vector<char> data(block->raw_size);
+                        DecodeBlock(*block, reinterpret_cast<unsigned char*>(data.data()), block_stats.get(), table.get());
+                        return data;
+                    };
+                    auto write = [data = SubmitTo(pool_.get(), decode), block_stats, out, out_offset]() mutable {
+                        std::vector<char> decoded = data.get();
+                        PhaseTimer timer(block_stats != nullptr);
+                        out->WriteAt(decoded.data(), decoded.size(), out_offset);
+                        if (block_stats != nullptr) {
+                            block_stats->io_seconds += timer.Lap();
+                        }
+                    };
+                    out_offset += block->raw_size;
+                    size_t member = stats_ != nullptr ? stats_->members.size() - 1 : 0;
+                    pending_.push_back({ SubmitTo(writer_pool_.get(), std::move(write)), member, block_stats });
+                    // Two blocks per worker plus the one being written stay in memory.
+                    WaitPending(2 * thread_count_);
+                } else {
+                    throw std::runtime_error("Decoder: Malformed archive.");
+                }
+            }
+            close_out();
+            WaitPending(0);
+        } catch (...) {
+            for (auto& task : pending_) {
+                task.done.wait();
             }
+            pending_.clear();
+            throw;
         }
+    }
 
-        out.close();
-        return one_more_file;
+    void Decoder::DecodeDuplicate(const std::string& file_name, const MemberInfo& original, uint64_t record_size,
+        const std::vector<MemberInfo>& members) {
+        // The original may still be being written.
+        WaitPending(0);
+        auto extracted = extracted_.find(original.name);
+        if (extracted != extracted_.end() && extracted->second == original.offset) {
+            StartMemberStats(file_name, record_size);
+            PhaseTimer timer(stats_ != nullptr);
+            if (file_name != original.name) {
+                OutputFile copy(file_name);
+                copy.CopyFrom(original.name);
+                copy.Close();
+            }
+            extracted_[file_name] = original.offset;
+            if (stats_ != nullptr) {
+                stats_->members.back().blocks.io_seconds += timer.Lap();
+                stats_->members.back().bytes_out += original.size;
+            }
+            return;
+        }
+        // The original was not extracted by this call, or its file has been replaced since: its records
+        // are decoded again into the duplicate's file.
+        std::shared_ptr<const DecodeTable> shared_table = shared_table_;
+        ReadMemberTable(original);
+        in_.clear();
+        in_.seekg(original.offset);
+        ByteReader reader(in_, original.offset);
+        DecodeRecords(reader, original.offset + original.packed_size, members, &file_name);
+        shared_table_ = shared_table;
     }
 
-    bool Decoder::DecodeFile() {
-        size_t symbols_count = reader_.Read(Huffman::SYMBOL_SIZE);
-        std::vector<std::pair<size_t, Letter>> char_codelen;
-        for (size_t i = 0; i < symbols_count; ++i) {
-            char_codelen.push_back({ 0, reader_.Read(Huffman::SYMBOL_SIZE) });
+    void Decoder::ReadMemberTable(const MemberInfo& member) {
+        if (member.table_offset == 0) {
+            shared_table_ = nullptr;
+            return;
         }
-        std::vector<size_t> len_count;
-        size_t len_sum = 0;
-        while (len_sum < symbols_count) {
-            len_count.push_back(reader_.Read(Huffman::SYMBOL_SIZE));
-            len_sum += len_count.back();
+        in_.clear();
+        in_.seekg(member.table_offset);
+        ByteReader reader(in_, member.table_offset);
+        if (reader.ReadByte() != RECORD_TABLE) {
+            throw std::runtime_error("Decoder: Malformed archive index.");
         }
-        size_t char_index = 0;
-        for (size_t i = 0; i < len_count.size(); ++i) {
-            for (size_t j = 0; j < len_count[i]; ++j) {
-                char_codelen[char_index].first = i + 1;
-                ++char_index;
+        ReadSharedTable(reader);
+    }
+
+    void Decoder::WaitPending(size_t max_pending) {
+        while (pending_.size() > max_pending) {
+            PendingBlock task = std::move(pending_.front());
+            pending_.pop_front();
+            task.done.get();
+            if (task.stats != nullptr) {
+                AddBlockStats(task.member, *task.stats);
             }
         }
-        HuffmanTree tree;
-        tree.BuildTreeWithLeaves(char_codelen);
+    }
 
-        return WriteFile(tree);
+    void Decoder::StartMemberStats(const std::string& file_name, uint64_t record_size) {
+        if (stats_ != nullptr) {
+            stats_->members.push_back({ file_name });
+            stats_->members.back().bytes_in = record_size;
+        }
+    }
+
+    void Decoder::AddBlockStats(size_t member, const BlockStats& block_stats) {
+        stats_->members[member].Add(block_stats);
+        stats_->members[member].bytes_out += block_stats.raw_size;
+    }
+
+    EncodedBlock Decoder::ReadBlock(ByteReader& reader, uint64_t end_offset) {
+        EncodedBlock block;
+        block.type = static_cast<BlockType>(reader.ReadByte());
+        block.raw_size = reader.ReadVarint();
+        block.bit_count = reader.ReadVarint();
+        // Checked before the payload is allocated.
+        if (block.raw_size > MAX_BLOCK_SIZE || block.bit_count > block.raw_size * MAX_BYTE_CODE_BITS + MAX_BLOCK_HEADER_BITS
+            || (block.bit_count + BYTE_SIZE - 1) / BYTE_SIZE > end_offset - std::min(end_offset, reader.Offset())) {
+            throw std::runtime_error("Decoder: Malformed block.");
+        }
+        block.payload.resize((block.bit_count + BYTE_SIZE - 1) / BYTE_SIZE);
+        reader.ReadBytes(block.payload.data(), block.payload.size());
+        return block;
+    }
+
+    void Decoder::ReadSharedTable(ByteReader& reader) {
+        uint64_t bit_count = reader.ReadVarint();
+        if (bit_count > SYMBOL_SIZE * (1 + SYMBOLS_COUNT + MAX_CODE_LENGTH)) {
+            throw std::runtime_error("Decoder: Malformed code table.");
+        }
+        std::vector<char> payload((bit_count + BYTE_SIZE - 1) / BYTE_SIZE);
+        reader.ReadBytes(payload.data(), payload.size());
+        BitReader table_reader(payload.data(), payload.size());
+        shared_table_ = std::make_shared<DecodeTable>(Huffman::ReadSharedTable(table_reader));
+    }
+
+    std::vector<MemberInfo> Decoder::DecodeLegacyFiles(const std::set<std::string>* file_names) {
+        BitReader reader(in_);
+        std::vector<MemberInfo> members;
+        bool one_more_file = true;
+        while (one_more_file) {
+            one_more_file = DecodeLegacyFile(reader, file_names, members);
+        }
+        return members;
+    }
+
+    bool Decoder::DecodeLegacyFile(BitReader& reader, const std::set<std::string>* file_names, std::vector<MemberInfo>& members) {
+        DecodeTable table(ReadCodeLengths(reader));
+
+        std::string output_file;
+        while (true) {
+            Letter char_value = table.Decode(reader);
+            if (char_value == Huffman::FILENAME_END) {
+                break;
+            }
+            output_file += static_cast<char>(char_value);
+        }
+        MemberInfo member = { output_file, 0, 0, 0, 0 };
+        bool extract = file_names == nullptr || file_names->count(output_file) > 0;
+        std::ofstream out;
+        if (extract) {
+            out.open(output_file, std::ios::binary);
+        }
+        bool one_more_file = false;
+        {
+            BitWriter writer(out);
+            while (true) {
+                Letter char_value = table.Decode(reader);
+                if (char_value == Huffman::ONE_MORE_FILE) {
+                    one_more_file = true;
+                    break;
+                }
+                if (char_value == Huffman::ARCHIVE_END) {
+                    break;
+                }
+                if (extract) {
+                    writer.Write(char_value);
+                }
+                ++member.size;
+            }
+        }
+
+        out.close();
+        members.push_back(member);
+        return one_more_file;
     }
 }
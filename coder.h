@@ -1,43 +1,188 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <istream>
+#include <memory>
 #include <ostream>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "archiveformat.h"
+#include "asyncoutput.h"
 #include "bitstream.h"
+#include "block.h"
+#include "decodetable.h"
 #include "huffman_constants.h"
 #include "huffmantree.h"
+#include "inputsource.h"
+#include "outputfile.h"
+#include "stats.h"
+#include "threadpool.h"
 
 namespace Huffman {
+    // Writes a version 2 archive. Every member is cut into BLOCK_SIZE blocks that are coded independently.
+    // Work is pipelined: the calling thread reads the inputs, thread_count workers code blocks concurrently,
+    // and a writer thread stores the finished records in order, so the archive does not depend on the
+    // number of threads. The index of all members is written on destruction.
     class Encoder {
     public:
-        explicit Encoder(std::ostream& out);
+        explicit Encoder(std::ostream& out, size_t thread_count = 1, const BlockOptions& block_options = {});
+        // Appends to an existing version 2 archive whose index starts at index_offset and lists members
+        // (see Decoder::ListFiles). out must be positioned at index_offset: new members overwrite the old
+        // index, and the new one lists the old members unchanged followed by the new ones. If encoding fails,
+        // the index is written after the last new member stored in full instead, and the archive ends at the
+        // current position of out once the encoder is destroyed; the caller truncates it there.
+        Encoder(std::ostream& out, const std::vector<MemberInfo>& members, uint64_t index_offset, size_t thread_count = 1,
+            const BlockOptions& block_options = {});
         ~Encoder();
 
-        void EncodeFile(std::istream& in, const std::string file_name);
+        void EncodeFile(const InputSource& source, const std::string& file_name);
+        // Reads in until end of stream, one BLOCK_SIZE window at a time; the stream is never held in memory.
+        void EncodeStream(std::istream& in, const std::string& file_name);
+        // A file named "-" is read from standard input as a stream.
+        void EncodeFiles(const std::vector<std::string>& file_names);
+        // Counts the bytes of all named files and writes one code table for them (solid mode). Blocks of
+        // members added afterwards use it instead of their own table whenever that is not larger.
+        void WriteSharedTable(const std::vector<std::string>& file_names);
+
+        // Per-member timings and code statistics are collected into stats while it is set; null disables them.
+        void SetStats(ArchiveStats* stats);
+        // While enabled, a file passed to EncodeFiles with the same contents as an earlier member of this
+        // encoder is stored as a reference to it. Files are hashed only when an earlier member has their size,
+        // and equal hashes are confirmed by comparing the bytes.
+        void SetDeduplication(bool enabled);
+
+        // Totals over the blocks written so far, in bits.
+        uint64_t PayloadBits() const;
+        uint64_t LengthLimitBits() const;
 
     private:
-        BitWriter writer_;
-        bool first_file_;
-        Huffman::Code one_more_file_code_;
-        Huffman::Code archive_end_code_;
+        struct PendingRecord {
+            bool is_member;
+            std::string file_name;
+            std::future<EncodedBlock> block;
+            std::shared_ptr<BlockStats> stats;
+            // Window of a stream member, reused once the block is written.
+            std::shared_ptr<char[]> buffer;
+            // Index in members_ of the member a duplicate member record repeats.
+            size_t original = SIZE_MAX;
+            // Set on the last record of a member.
+            bool completes_member = false;
+        };
+
+        // A member of this encoder read from a file, which later files of its size are compared with.
+        struct DedupCandidate {
+            std::string file_name;
+            size_t member;
+            bool hashed;
+            uint64_t hash;
+        };
 
-        std::vector<size_t> GetCharCount(std::istream& in, const std::string file_name) const;
-        void WriteOutput(const std::vector<HuffmanTree::EncodedChar>& encoded_chars, const std::string& file_name);
+        std::ostream& out_;
+        AsyncOutputBuffer output_buffer_;
+        std::ostream output_;
+        ByteWriter writer_;
+        size_t thread_count_;
+        BlockOptions block_options_;
+        std::unique_ptr<ThreadPool> pool_;
+        std::deque<PendingRecord> pending_;
+        std::vector<MemberInfo> members_;
+        // Members already in the archive when appending; they are never changed.
+        size_t kept_member_count_;
+        bool appending_;
+        // Members whose records have all been written, and the offset where the last of them ends.
+        size_t complete_member_count_;
+        uint64_t complete_offset_;
+        bool failed_;
+        ArchiveStats* stats_;
+        uint64_t payload_bits_;
+        uint64_t length_limit_bits_;
+        std::shared_ptr<const HuffmanTree::CodeTable> shared_table_;
+        uint64_t table_offset_;
+        std::vector<std::shared_ptr<char[]>> free_buffers_;
+        bool deduplicate_;
+        // Candidates by size; member_count_ counts the members submitted so far, kept ones included.
+        std::unordered_map<uint64_t, std::vector<DedupCandidate>> dedup_candidates_;
+        size_t member_count_;
+
+        void Initialize(size_t thread_count, const BlockOptions& block_options);
+        // Drops the pending records after an error; the destructor then writes no index unless appending.
+        void Abort();
+        MemberStats& CurrentMemberStats();
+        void SubmitMember(std::shared_ptr<const InputSource> source, const std::string& file_name);
+        void SubmitStream(std::istream& in, const std::string& file_name);
+        void SubmitDuplicate(const std::string& file_name, size_t original);
+        // Returns whether source repeats an earlier candidate and sets original to its member; otherwise
+        // source becomes a candidate itself, as the next member to be submitted.
+        bool FindDuplicate(const InputSource& source, const std::string& file_name, size_t& original);
+        void WritePending(size_t max_pending);
+        void WriteRecord(PendingRecord& record);
+        void FinishMember();
+        void WriteIndex();
     };
 
+    // Extracts archives. Version 2 archives are read by the calling thread while thread_count workers
+    // decode their blocks concurrently and a writer thread stores them at their offsets in the output files.
     class Decoder {
     public:
-        explicit Decoder(std::istream& in);
+        explicit Decoder(std::istream& in, size_t thread_count = 1);
 
         void DecodeFiles();
+        // Extracts only the named members. Version 2 archives seek to them through the index.
+        void DecodeFiles(const std::vector<std::string>& file_names);
+        std::vector<MemberInfo> ListFiles();
+        // As ListFiles for version 2 archives, which can be appended to; index_offset receives the offset
+        // of the index, where new members start. Throws for version 1 archives.
+        std::vector<MemberInfo> ListFiles(uint64_t& index_offset);
+        // Reads a version 2 archive front to back without seeking and writes the contents of all
+        // members to out in order, keeping at most two decoded blocks per thread in memory.
+        void DecodeStream(std::ostream& out);
+        // As Encoder::SetStats; version 1 archives are not instrumented.
+        void SetStats(ArchiveStats* stats);
 
     private:
-        BitReader reader_;
+        struct PendingBlock {
+            std::future<void> done;
+            size_t member;
+            std::shared_ptr<BlockStats> stats;
+        };
+
+        std::istream& in_;
+        size_t thread_count_;
+        std::unique_ptr<ThreadPool> pool_;
+        std::unique_ptr<ThreadPool> writer_pool_;
+        std::deque<PendingBlock> pending_;
+        ArchiveStats* stats_;
+        std::shared_ptr<const DecodeTable> shared_table_;
+        // Files written by the current extraction, with the offset of the member whose contents each holds;
+        // duplicates of those members are copied from them.
+        std::unordered_map<std::string, uint64_t> extracted_;
+
+        bool ReadHeader();
+        bool ReadVersionHeader();
+        std::vector<MemberInfo> ReadIndex(uint64_t* index_offset = nullptr);
+        // Decodes records up to end_offset; members found in members are preallocated to their size.
+        // With a file_name, reader is at a single member, which is written to file_name instead of its own name.
+        void DecodeRecords(ByteReader& reader, uint64_t end_offset, const std::vector<MemberInfo>& members,
+            const std::string* file_name = nullptr);
+        // Writes the contents of original to file_name for a duplicate member, leaving in_ anywhere.
+        void DecodeDuplicate(const std::string& file_name, const MemberInfo& original, uint64_t record_size,
+            const std::vector<MemberInfo>& members);
+        // Loads the shared code table a member's blocks are coded with, if any.
+        void ReadMemberTable(const MemberInfo& member);
+        void WaitPending(size_t max_pending);
+        void StartMemberStats(const std::string& file_name, uint64_t record_size);
+        void AddBlockStats(size_t member, const BlockStats& block_stats);
+        // Payloads reaching past end_offset, where the records being read end, are rejected unread.
+        static EncodedBlock ReadBlock(ByteReader& reader, uint64_t end_offset);
+        void ReadSharedTable(ByteReader& reader);
 
-        bool WriteFile(HuffmanTree& tree);
-        bool DecodeFile();
+        std::vector<MemberInfo> DecodeLegacyFiles(const std::set<std::string>* file_names);
+        bool DecodeLegacyFile(BitReader& reader, const std::set<std::string>* file_names, std::vector<MemberInfo>& members);
     };
 }
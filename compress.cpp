@@ -0,0 +1,92 @@
+#include "compress.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "archiveformat.h"
+
+namespace Huffman {
+    namespace {
+        const size_t MAX_VARINT_SIZE = 10;
+        // The code length header of a block: symbol count, symbols and counts per length.
+        const size_t MAX_CODE_HEADER_SIZE = (SYMBOL_SIZE * (1 + SYMBOLS_COUNT + MAX_CODE_LENGTH) + BYTE_SIZE - 1) / BYTE_SIZE;
+        // Sub-stream sizes of an interleaved block, padded to a whole byte with the code header.
+        const size_t MAX_STREAM_SIZES_SIZE = (INTERLEAVED_STREAM_COUNT - 1) * INTERLEAVED_SIZE_BITS / BYTE_SIZE + 1;
+        // Record type, block type, raw size and bit count around the payload.
+        const size_t MAX_BLOCK_OVERHEAD = 2 + 2 * MAX_VARINT_SIZE + MAX_CODE_HEADER_SIZE + MAX_STREAM_SIZES_SIZE;
+    }
+
+    size_t CompressBound(size_t size) {
+        // Codes never average more than BYTE_SIZE bits per byte: a fixed-length code for the symbols of a
+        // block is never longer than that and fits under any length limit that fits the block at all.
+        size_t block_count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        return 1 + MAX_VARINT_SIZE + size + block_count * MAX_BLOCK_OVERHEAD;
+    }
+
+    ByteSpan Compress(ByteSpan input, MutableByteSpan output, const BlockOptions& options) {
+        char* out = reinterpret_cast<char*>(output.data);
+        ByteWriter writer(out, output.size);
+        writer.WriteByte(FORMAT_VERSION);
+        writer.WriteVarint(input.size);
+        size_t frame_size = writer.Offset();
+        for (size_t offset = 0; offset < input.size; offset += BLOCK_SIZE) {
+            size_t size = std::min(BLOCK_SIZE, input.size - offset);
+            // No block takes more bits than a stored one, so with the bit count padded to that width the
+            // header size is known up front and the payload is coded straight into place behind it.
+            size_t bit_count_width = VarintSize(size * BYTE_SIZE);
+            size_t header_size = 2 + VarintSize(size) + bit_count_width;
+            if (header_size > output.size - frame_size) {
+                throw std::runtime_error("Compress: Output buffer is too small.");
+            }
+            PayloadBuffer payload(out + frame_size + header_size, output.size - frame_size - header_size);
+            EncodedBlock block = EncodeBlock(payload, input.data + offset, size, options);
+            ByteWriter header(out + frame_size, header_size);
+            header.WriteByte(RECORD_BLOCK);
+            header.WriteByte(static_cast<uint8_t>(block.type));
+            header.WriteVarint(block.raw_size);
+            header.WriteVarint(block.bit_count, bit_count_width);
+            frame_size += header_size + payload.Size();
+        }
+        return { output.data, frame_size };
+    }
+
+    size_t DecompressedSize(ByteSpan frame) {
+        ByteReader reader(reinterpret_cast<const char*>(frame.data), frame.size);
+        if (reader.ReadByte() != FORMAT_VERSION) {
+            throw std::runtime_error("DecompressedSize: Unsupported frame version.");
+        }
+        return reader.ReadVarint();
+    }
+
+    ByteSpan Decompress(ByteSpan frame, MutableByteSpan output) {
+        const char* data = reinterpret_cast<const char*>(frame.data);
+        ByteReader reader(data, frame.size);
+        if (reader.ReadByte() != FORMAT_VERSION) {
+            throw std::runtime_error("Decompress: Unsupported frame version.");
+        }
+        uint64_t raw_size = reader.ReadVarint();
+        if (raw_size > output.size) {
+            throw std::runtime_error("Decompress: Output buffer is too small.");
+        }
+        size_t offset = 0;
+        while (offset < raw_size) {
+            if (reader.ReadByte() != RECORD_BLOCK) {
+                throw std::runtime_error("Decompress: Malformed frame.");
+            }
+            BlockView block;
+            block.type = static_cast<BlockType>(reader.ReadByte());
+            block.raw_size = reader.ReadVarint();
+            block.bit_count = reader.ReadVarint();
+            if (block.raw_size == 0 || block.raw_size > raw_size - offset || block.bit_count > frame.size * BYTE_SIZE) {
+                throw std::runtime_error("Decompress: Malformed frame.");
+            }
+            // The payload is decoded in place from the caller's buffer.
+            block.payload = data + reader.Offset();
+            block.payload_size = (block.bit_count + BYTE_SIZE - 1) / BYTE_SIZE;
+            reader.SkipBytes(block.payload_size);
+            DecodeBlock(block, output.data + offset);
+            offset += block.raw_size;
+        }
+        return { output.data, offset };
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+#include "block.h"
+
+// Buffer-to-buffer interface of the library. A compressed frame holds:
+//   u8 FORMAT_VERSION, raw size (varint), then the raw data cut into BLOCK_SIZE blocks, each stored
+//   as a block record as in an archive (see archiveformat.h). The payload bit count of a record is
+//   padded to the width of raw size * BYTE_SIZE, so the frame is written in a single pass.
+// Frames carry no names and no index; they are meant to be embedded in the caller's own containers.
+namespace Huffman {
+    struct ByteSpan {
+        const unsigned char* data;
+        size_t size;
+    };
+
+    struct MutableByteSpan {
+        unsigned char* data;
+        size_t size;
+    };
+
+    // Largest frame Compress can produce for size input bytes.
+    size_t CompressBound(size_t size);
+
+    // Compresses input into output and returns the part of output holding the frame.
+    // Throws if output is smaller than needed; CompressBound(input.size) bytes are always enough.
+    ByteSpan Compress(ByteSpan input, MutableByteSpan output, const BlockOptions& options = {});
+
+    // Size of the data stored in a frame, read from its header.
+    size_t DecompressedSize(ByteSpan frame);
+
+    // Decodes a frame into output, which must hold at least DecompressedSize(frame) bytes, and returns
+    // the part of output holding the data.
+    ByteSpan Decompress(ByteSpan frame, MutableByteSpan output);
+}
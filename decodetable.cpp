@@ -0,0 +1,73 @@
+#include "decodetable.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Huffman {
+    DecodeTable::DecodeTable(const std::vector<std::pair<size_t, Letter>>& char_codelen)
+        : entries_(size_t(1) << ROOT_BITS, Entry{ 0, 0, 0 }) {
+        has_fallback_ = false;
+        max_code_length_ = 0;
+        const size_t root_mask = (size_t(1) << ROOT_BITS) - 1;
+        HuffmanTree::CodeTable codes = HuffmanTree::GetCanonicalHuffmanCodes(char_codelen);
+
+        std::vector<size_t> longest_code(size_t(1) << ROOT_BITS, 0);
+        for (const auto& [codelen, char_value] : char_codelen) {
+            max_code_length_ = std::max(max_code_length_, codelen);
+            if (codelen > ROOT_BITS) {
+                size_t& longest = longest_code[codes[char_value].code & root_mask];
+                longest = std::max(longest, codelen);
+            }
+        }
+
+        for (size_t prefix = 0; prefix < longest_code.size(); ++prefix) {
+            if (longest_code[prefix] > 0) {
+                size_t sub_bits = std::min(longest_code[prefix] - ROOT_BITS, MAX_SUB_BITS);
+                entries_[prefix] = { static_cast<uint32_t>(entries_.size()), 0, static_cast<uint16_t>(sub_bits) };
+                entries_.resize(entries_.size() + (size_t(1) << sub_bits), Entry{ 0, 0, 0 });
+            }
+        }
+
+        for (const auto& [codelen, char_value] : char_codelen) {
+            Huffman::Code code = codes[char_value].code;
+            Entry symbol = { static_cast<uint32_t>(char_value), static_cast<uint16_t>(codelen), 0 };
+            if (codelen <= ROOT_BITS) {
+                for (size_t fill = 0; fill < (size_t(1) << (ROOT_BITS - codelen)); ++fill) {
+                    entries_[code ^ (fill << codelen)] = symbol;
+                }
+                continue;
+            }
+            Entry sub_table = entries_[code & root_mask];
+            size_t rest = code >> ROOT_BITS;
+            size_t rest_len = codelen - ROOT_BITS;
+            if (rest_len > sub_table.sub_bits) {
+                has_fallback_ = true;
+                continue;
+            }
+            for (size_t fill = 0; fill < (size_t(1) << (sub_table.sub_bits - rest_len)); ++fill) {
+                entries_[sub_table.value + (rest ^ (fill << rest_len))] = symbol;
+            }
+        }
+
+        if (has_fallback_) {
+            fallback_tree_.BuildTreeWithLeaves(char_codelen);
+        }
+    }
+
+    size_t DecodeTable::MaxCodeLength() const {
+        return max_code_length_;
+    }
+
+    Letter DecodeTable::DecodeWithTree(BitReader& reader) const {
+        if (!has_fallback_) {
+            throw std::runtime_error("DecodeTable: Invalid code in stream.");
+        }
+        size_t node = 0;
+        while (true) {
+            auto opt_char = fallback_tree_.NextNode(node, reader.Read(1));
+            if (opt_char.has_value()) {
+                return opt_char.value();
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bitstream.h"
+#include "huffman_constants.h"
+#include "huffmantree.h"
+
+namespace Huffman {
+    // Resolves a whole canonical code with one probe of a ROOT_BITS wide table, or two probes when the
+    // code is longer. Codes that do not fit into the second level are decoded by walking the tree.
+    class DecodeTable {
+    public:
+        static constexpr size_t ROOT_BITS = 11;
+        static constexpr size_t MAX_SUB_BITS = 11;
+
+        explicit DecodeTable(const std::vector<std::pair<size_t, Letter>>& char_codelen);
+
+        size_t MaxCodeLength() const;
+
+        // Inline so that callers decoding several independent streams can overlap the lookups.
+        Letter Decode(BitReader& reader) const {
+            size_t bits = reader.Peek(ROOT_BITS + MAX_SUB_BITS);
+            Entry entry = entries_[bits & ((size_t(1) << ROOT_BITS) - 1)];
+            if (entry.length == 0 && entry.sub_bits > 0) {
+                entry = entries_[entry.value + ((bits >> ROOT_BITS) & ((size_t(1) << entry.sub_bits) - 1))];
+            }
+            if (entry.length == 0) {
+                return DecodeWithTree(reader);
+            }
+            reader.Skip(entry.length);
+            return entry.value;
+        }
+
+    private:
+        // length > 0: a symbol `value` with a code of `length` bits.
+        // length == 0, sub_bits > 0: a sub-table at offset `value` indexed by the next `sub_bits` bits.
+        // length == 0, sub_bits == 0: a code longer than the sub-table, decoded with fallback_tree_.
+        struct Entry {
+            uint32_t value;
+            uint16_t length;
+            uint16_t sub_bits;
+        };
+
+        std::vector<Entry> entries_;
+        size_t max_code_length_;
+        HuffmanTree fallback_tree_;
+        bool has_fallback_;
+
+        Letter DecodeWithTree(BitReader& reader) const;
+    };
+}
@@ -0,0 +1,265 @@
+#include "encodekernel.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HUFFMAN_ENCODE_BMI2
+#endif
+
+namespace Huffman {
+    namespace {
+        // A packed code holds the code bits below LENGTH_SHIFT and its length above.
+        const size_t LENGTH_SHIFT = 56;
+        const uint64_t CODE_MASK = (uint64_t(1) << LENGTH_SHIFT) - 1;
+        // Codes that are merged and stored at once, together with the up to 7 bits left from the previous
+        // store, never take more than 63 bits.
+        const size_t MAX_MERGED_BITS = 56;
+        // Input coded between checks of the output capacity.
+        const size_t CHUNK_SIZE = 1 << 16;
+
+        using PackedCodes = std::array<uint64_t, 256>;
+
+        // Cursor of one bit stream: bytes before out are final, acc holds the bits bits that follow them.
+        struct BitSink {
+            char* out;
+            uint64_t acc;
+            size_t bits;
+        };
+
+        // Returns the longest code, or 0 when some code does not fit below LENGTH_SHIFT.
+        size_t PackCodes(const HuffmanTree::CodeTable& encoded_chars, PackedCodes& codes) {
+            size_t longest = 0;
+            for (size_t i = 0; i < codes.size(); ++i) {
+                longest = std::max(longest, encoded_chars[i].codelen);
+                codes[i] = (encoded_chars[i].code & CODE_MASK) | static_cast<uint64_t>(encoded_chars[i].codelen) << LENGTH_SHIFT;
+            }
+            return longest <= MAX_MERGED_BITS ? longest : 0;
+        }
+
+        __attribute__((always_inline)) inline void Store(BitSink& sink) {
+            uint64_t word = sink.acc;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            word = __builtin_bswap64(word);
+#endif
+            std::memcpy(sink.out, &word, sizeof(word));
+            sink.out += sink.bits / 8;
+            sink.acc >>= sink.bits & ~size_t(7);
+            sink.bits %= 8;
+        }
+
+        // The bit offset of every code in the group is the sum of the lengths before it, so the codes are
+        // shifted into place independently and the stream position moves once per group.
+        template <size_t GROUP>
+        __attribute__((always_inline)) inline void PutGroup(BitSink& sink, const PackedCodes& codes, const unsigned char* bytes, size_t step) {
+            uint64_t merged = 0;
+            size_t length = 0;
+            for (size_t i = 0; i < GROUP; ++i) {
+                uint64_t code = codes[bytes[i * step]];
+                merged |= (code & CODE_MASK) << length;
+                length += code >> LENGTH_SHIFT;
+            }
+            sink.acc |= merged << sink.bits;
+            sink.bits += length;
+            Store(sink);
+        }
+
+        // Eight bytes per iteration, in groups of GROUP codes.
+        template <size_t GROUP>
+        __attribute__((always_inline)) inline void EncodeRun(BitSink& sink, const PackedCodes& codes, const unsigned char* data, size_t size) {
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8) {
+                for (size_t group = 0; group < 8; group += GROUP) {
+                    PutGroup<GROUP>(sink, codes, data + i + group, 1);
+                }
+            }
+            for (; i < size; ++i) {
+                PutGroup<1>(sink, codes, data + i, 1);
+            }
+        }
+
+        // Sixteen bytes per iteration, four for every stream, in groups of GROUP codes.
+        template <size_t GROUP>
+        __attribute__((always_inline)) inline void EncodeInterleavedRun(BitSink (&sinks)[INTERLEAVED_STREAM_COUNT], const PackedCodes& codes,
+            const unsigned char* data, size_t size) {
+            const size_t step = INTERLEAVED_STREAM_COUNT;
+            size_t i = 0;
+            for (; i + 4 * step <= size; i += 4 * step) {
+                for (size_t stream = 0; stream < step; ++stream) {
+                    for (size_t group = 0; group < 4; group += GROUP) {
+                        PutGroup<GROUP>(sinks[stream], codes, data + i + group * step + stream, step);
+                    }
+                }
+            }
+            for (size_t stream = 0; i < size; ++i, stream = (stream + 1) % step) {
+                PutGroup<1>(sinks[stream], codes, data + i, 1);
+            }
+        }
+
+        // Codes longer than MAX_MERGED_BITS (escaped bytes of sampled blocks) are stored in two parts.
+        void EncodeLong(BitSink& sink, const HuffmanTree::CodeTable& encoded_chars, const unsigned char* data, size_t size, size_t step) {
+            for (size_t i = 0; i < size; i += step) {
+                const auto& encoded_char = encoded_chars[data[i]];
+                Code code = encoded_char.code;
+                size_t length = encoded_char.codelen;
+                if (length > MAX_MERGED_BITS) {
+                    sink.acc |= (code & CODE_MASK) << sink.bits;
+                    sink.bits += MAX_MERGED_BITS;
+                    Store(sink);
+                    code >>= MAX_MERGED_BITS;
+                    length -= MAX_MERGED_BITS;
+                }
+                sink.acc |= code << sink.bits;
+                sink.bits += length;
+                Store(sink);
+            }
+        }
+
+        __attribute__((always_inline)) inline void Encode(BitSink& sink, const PackedCodes& codes, size_t longest, const unsigned char* data,
+            size_t size) {
+            if (longest <= MAX_MERGED_BITS / 4) {
+                EncodeRun<4>(sink, codes, data, size);
+            } else if (longest <= MAX_MERGED_BITS / 2) {
+                EncodeRun<2>(sink, codes, data, size);
+            } else {
+                EncodeRun<1>(sink, codes, data, size);
+            }
+        }
+
+        __attribute__((always_inline)) inline void EncodeInterleaved(BitSink (&sinks)[INTERLEAVED_STREAM_COUNT], const PackedCodes& codes,
+            size_t longest, const unsigned char* data, size_t size) {
+            if (longest <= MAX_MERGED_BITS / 4) {
+                EncodeInterleavedRun<4>(sinks, codes, data, size);
+            } else if (longest <= MAX_MERGED_BITS / 2) {
+                EncodeInterleavedRun<2>(sinks, codes, data, size);
+            } else {
+                EncodeInterleavedRun<1>(sinks, codes, data, size);
+            }
+        }
+
+        void EncodeScalar(BitSink& sink, const PackedCodes& codes, size_t longest, const unsigned char* data, size_t size) {
+            Encode(sink, codes, longest, data, size);
+        }
+
+        void EncodeInterleavedScalar(BitSink (&sinks)[INTERLEAVED_STREAM_COUNT], const PackedCodes& codes, size_t longest,
+            const unsigned char* data, size_t size) {
+            EncodeInterleaved(sinks, codes, longest, data, size);
+        }
+
+#ifdef HUFFMAN_ENCODE_BMI2
+        // The same kernels with SHLX and SHRX, which shift by a register without tying up CL.
+        __attribute__((target("bmi2"))) void EncodeBmi2(BitSink& sink, const PackedCodes& codes, size_t longest, const unsigned char* data,
+            size_t size) {
+            Encode(sink, codes, longest, data, size);
+        }
+
+        __attribute__((target("bmi2"))) void EncodeInterleavedBmi2(BitSink (&sinks)[INTERLEAVED_STREAM_COUNT], const PackedCodes& codes,
+            size_t longest, const unsigned char* data, size_t size) {
+            EncodeInterleaved(sinks, codes, longest, data, size);
+        }
+
+        bool HasBmi2() {
+            static const bool has_bmi2 = __builtin_cpu_supports("bmi2");
+            return has_bmi2;
+        }
+#endif
+
+        // Makes room after offset for the codes of byte_count bytes and the overhanging store.
+        char* Reserve(std::vector<char>& out, size_t offset, size_t byte_count, size_t longest) {
+            out.resize(offset + (7 + byte_count * longest) / 8 + sizeof(uint64_t));
+            return out.data() + offset;
+        }
+
+        char* Reserve(PayloadBuffer& out, size_t offset, size_t byte_count, size_t longest) {
+            out.Resize(offset + (7 + byte_count * longest) / 8 + sizeof(uint64_t));
+            return out.Data() + offset;
+        }
+
+        // Bytes of input, up to CHUNK_SIZE, whose codes Reserve can make room for within the capacity of out.
+        size_t FittingChunkSize(const PayloadBuffer& out, size_t offset, size_t longest) {
+            if (out.Capacity() < offset + sizeof(uint64_t)) {
+                return 0;
+            }
+            size_t room = out.Capacity() - offset - sizeof(uint64_t);
+            return room >= CHUNK_SIZE * longest / 8 ? CHUNK_SIZE : room * 8 / longest;
+        }
+    }
+
+    size_t AppendCodes(PayloadBuffer& out, size_t bit_count, const HuffmanTree::CodeTable& encoded_chars,
+        const unsigned char* data, size_t size) {
+        PackedCodes codes;
+        size_t longest = PackCodes(encoded_chars, codes);
+        size_t code_bits = longest > 0 ? longest : 2 * MAX_MERGED_BITS;
+        size_t offset = bit_count / 8;
+        BitSink sink = { nullptr, 0, bit_count % 8 };
+        if (sink.bits > 0) {
+            sink.acc = static_cast<unsigned char>(out.Data()[offset]);
+        }
+        // Near the end of a caller's buffer the chunks shrink to what still fits.
+        for (size_t done = 0, chunk_size = 0; done < size; done += chunk_size) {
+            chunk_size = std::min(FittingChunkSize(out, offset, code_bits), size - done);
+            if (chunk_size == 0) {
+                throw PayloadOverflow();
+            }
+            sink.out = Reserve(out, offset, chunk_size, code_bits);
+            if (longest == 0) {
+                EncodeLong(sink, encoded_chars, data + done, chunk_size, 1);
+            } else {
+#ifdef HUFFMAN_ENCODE_BMI2
+                if (HasBmi2()) {
+                    EncodeBmi2(sink, codes, longest, data + done, chunk_size);
+                } else {
+                    EncodeScalar(sink, codes, longest, data + done, chunk_size);
+                }
+#else
+                EncodeScalar(sink, codes, longest, data + done, chunk_size);
+#endif
+            }
+            offset = sink.out - out.Data();
+        }
+        out.Resize(offset + (sink.bits + 7) / 8);
+        return offset * 8 + sink.bits;
+    }
+
+    void AppendInterleavedCodes(std::vector<char> (&streams)[INTERLEAVED_STREAM_COUNT], const HuffmanTree::CodeTable& encoded_chars,
+        const unsigned char* data, size_t size) {
+        PackedCodes codes;
+        size_t longest = PackCodes(encoded_chars, codes);
+        BitSink sinks[INTERLEAVED_STREAM_COUNT];
+        size_t offsets[INTERLEAVED_STREAM_COUNT] = {};
+        for (auto& sink : sinks) {
+            sink = { nullptr, 0, 0 };
+        }
+        // Chunks start at multiples of the stream count, so byte i always goes to stream i % INTERLEAVED_STREAM_COUNT.
+        for (size_t done = 0; done < size; done += CHUNK_SIZE) {
+            size_t chunk_size = std::min(CHUNK_SIZE, size - done);
+            for (size_t stream = 0; stream < INTERLEAVED_STREAM_COUNT; ++stream) {
+                sinks[stream].out = Reserve(streams[stream], offsets[stream], (chunk_size + INTERLEAVED_STREAM_COUNT - 1) / INTERLEAVED_STREAM_COUNT,
+                    longest > 0 ? longest : 2 * MAX_MERGED_BITS);
+            }
+            if (longest == 0) {
+                for (size_t stream = 0; stream < INTERLEAVED_STREAM_COUNT && stream < chunk_size; ++stream) {
+                    EncodeLong(sinks[stream], encoded_chars, data + done + stream, chunk_size - stream, INTERLEAVED_STREAM_COUNT);
+                }
+            } else {
+#ifdef HUFFMAN_ENCODE_BMI2
+                if (HasBmi2()) {
+                    EncodeInterleavedBmi2(sinks, codes, longest, data + done, chunk_size);
+                } else {
+                    EncodeInterleavedScalar(sinks, codes, longest, data + done, chunk_size);
+                }
+#else
+                EncodeInterleavedScalar(sinks, codes, longest, data + done, chunk_size);
+#endif
+            }
+            for (size_t stream = 0; stream < INTERLEAVED_STREAM_COUNT; ++stream) {
+                offsets[stream] = sinks[stream].out - streams[stream].data();
+            }
+        }
+        for (size_t stream = 0; stream < INTERLEAVED_STREAM_COUNT; ++stream) {
+            streams[stream].resize(offsets[stream] + (sinks[stream].bits + 7) / 8);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "block.h"
+#include "huffmantree.h"
+#include "payloadbuffer.h"
+
+namespace Huffman {
+    // Appends the codes of size bytes of data from encoded_chars to the LSB-first bit stream in out, which
+    // holds bit_count bits so far with zeros past them, and returns its new bit count. The result is the
+    // same as writing the codes one by one with a BitWriter; several short codes are merged and stored at
+    // once, and on CPUs with BMI2 the kernel is built with its variable shifts. Stores overhang the codes
+    // by up to 8 bytes, so a caller's buffer throws PayloadOverflow unless it has room for those as well.
+    size_t AppendCodes(PayloadBuffer& out, size_t bit_count, const HuffmanTree::CodeTable& encoded_chars,
+        const unsigned char* data, size_t size);
+    // Codes byte i of data into streams[i % INTERLEAVED_STREAM_COUNT], which must be empty, keeping all
+    // streams in flight at once. Each stream is padded to a whole byte.
+    void AppendInterleavedCodes(std::vector<char> (&streams)[INTERLEAVED_STREAM_COUNT], const HuffmanTree::CodeTable& encoded_chars,
+        const unsigned char* data, size_t size);
+}
@@ -0,0 +1,77 @@
+#include "hash.h"
+
+#include <cstring>
+
+namespace Huffman {
+    namespace {
+        const uint64_t PRIME1 = 0x9E3779B185EBCA87;
+        const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4F;
+        const uint64_t PRIME3 = 0x165667B19E3779F9;
+        const uint64_t PRIME4 = 0x85EBCA77C2B2AE63;
+        const uint64_t PRIME5 = 0x27D4EB2F165667C5;
+        const size_t STRIPE_SIZE = 32;
+
+        uint64_t RotateLeft(uint64_t value, int bits) {
+            return (value << bits) | (value >> (64 - bits));
+        }
+
+        uint64_t Load64(const unsigned char* data) {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        uint32_t Load32(const unsigned char* data) {
+            uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        uint64_t Round(uint64_t accumulator, uint64_t input) {
+            return RotateLeft(accumulator + input * PRIME2, 31) * PRIME1;
+        }
+
+        uint64_t Merge(uint64_t hash, uint64_t accumulator) {
+            return (hash ^ Round(0, accumulator)) * PRIME1 + PRIME4;
+        }
+    }
+
+    uint64_t HashBytes(const unsigned char* data, size_t size) {
+        const unsigned char* end = data + size;
+        uint64_t hash;
+        if (size >= STRIPE_SIZE) {
+            // Four independent lanes keep the multiplier busy.
+            uint64_t lanes[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+            for (; end - data >= static_cast<std::ptrdiff_t>(STRIPE_SIZE); data += STRIPE_SIZE) {
+                for (size_t lane = 0; lane < 4; ++lane) {
+                    lanes[lane] = Round(lanes[lane], Load64(data + lane * sizeof(uint64_t)));
+                }
+            }
+            hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+            for (uint64_t lane : lanes) {
+                hash = Merge(hash, lane);
+            }
+        } else {
+            hash = PRIME5;
+        }
+        hash += size;
+
+        for (; end - data >= 8; data += 8) {
+            hash = RotateLeft(hash ^ Round(0, Load64(data)), 27) * PRIME1 + PRIME4;
+        }
+        if (end - data >= 4) {
+            hash = RotateLeft(hash ^ (Load32(data) * PRIME1), 23) * PRIME2 + PRIME3;
+            data += 4;
+        }
+        for (; data < end; ++data) {
+            hash = RotateLeft(hash ^ (*data * PRIME5), 11) * PRIME1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME2;
+        hash ^= hash >> 29;
+        hash *= PRIME3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+}
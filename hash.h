@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Huffman {
+    // Fast non-cryptographic 64-bit hash of data (the XXH64 algorithm with seed 0). Equal hashes only
+    // suggest equal contents; callers that rely on equality compare the bytes as well.
+    uint64_t HashBytes(const unsigned char* data, size_t size);
+}
@@ -0,0 +1,86 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HUFFMAN_HISTOGRAM_AVX2
+#endif
+
+namespace Huffman {
+    namespace {
+        const size_t TABLE_COUNT = 4;
+        const size_t BYTE_VALUES = 256;
+        // Keeps every 32-bit counter below overflow however large the input is.
+        const size_t MAX_CHUNK_SIZE = static_cast<size_t>(1) << 30;
+
+        using CountTables = uint32_t[TABLE_COUNT][BYTE_VALUES];
+
+        void CountScalar(const unsigned char* data, size_t size, CountTables& tables) {
+            size_t i = 0;
+            for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+                uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                ++tables[0][word & 0xFF];
+                ++tables[1][(word >> 8) & 0xFF];
+                ++tables[2][(word >> 16) & 0xFF];
+                ++tables[3][(word >> 24) & 0xFF];
+                ++tables[0][(word >> 32) & 0xFF];
+                ++tables[1][(word >> 40) & 0xFF];
+                ++tables[2][(word >> 48) & 0xFF];
+                ++tables[3][word >> 56];
+            }
+            for (; i < size; ++i) {
+                ++tables[0][data[i]];
+            }
+        }
+
+#ifdef HUFFMAN_HISTOGRAM_AVX2
+        const size_t RUN_SIZE = 32;
+
+        __attribute__((target("avx2"))) void CountAvx2(const unsigned char* data, size_t size, CountTables& tables) {
+            size_t i = 0;
+            for (; i + RUN_SIZE <= size; i += RUN_SIZE) {
+                __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                __m256i first = _mm256_set1_epi8(static_cast<char>(data[i]));
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, first)) == -1) {
+                    tables[0][data[i]] += RUN_SIZE;
+                } else {
+                    CountScalar(data + i, RUN_SIZE, tables);
+                }
+            }
+            CountScalar(data + i, size - i, tables);
+        }
+
+        bool HasAvx2() {
+            static const bool has_avx2 = __builtin_cpu_supports("avx2");
+            return has_avx2;
+        }
+#endif
+    }
+
+    std::vector<size_t> CountBytes(const unsigned char* data, size_t size) {
+        std::vector<size_t> char_count(Huffman::SYMBOLS_COUNT, 0);
+        for (size_t offset = 0; offset < size; offset += MAX_CHUNK_SIZE) {
+            size_t chunk_size = std::min(MAX_CHUNK_SIZE, size - offset);
+            CountTables tables = {};
+#ifdef HUFFMAN_HISTOGRAM_AVX2
+            if (HasAvx2()) {
+                CountAvx2(data + offset, chunk_size, tables);
+            } else {
+                CountScalar(data + offset, chunk_size, tables);
+            }
+#else
+            CountScalar(data + offset, chunk_size, tables);
+#endif
+            for (size_t table = 0; table < TABLE_COUNT; ++table) {
+                for (size_t value = 0; value < BYTE_VALUES; ++value) {
+                    char_count[value] += tables[table][value];
+                }
+            }
+        }
+        return char_count;
+    }
+}
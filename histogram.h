@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "huffman_constants.h"
+
+namespace Huffman {
+    // Byte frequencies of data in a SYMBOLS_COUNT-sized vector, as HuffmanTree::GetEncodedChars expects.
+    // Counts go to four interleaved tables so that runs of one byte do not wait on a single counter;
+    // on CPUs with AVX2, 32-byte runs of one value are detected and counted at once.
+    std::vector<size_t> CountBytes(const unsigned char* data, size_t size);
+}
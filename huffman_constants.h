@@ -1,14 +1,17 @@
 #pragma once
 
-#include <vector>
+#include <cstddef>
+#include <cstdint>
 
 namespace Huffman {
     using Letter = size_t;
-    using Code = std::vector<bool>;
+    // Canonical code bits reversed so that the first bit to be written is bit 0.
+    using Code = uint64_t;
 
     const size_t BYTE_SIZE = 8;
     const size_t SYMBOL_SIZE = 9;
     const size_t SYMBOLS_COUNT = (1 << 8) + 3;
+    const size_t MAX_CODE_LENGTH = 56;
 
     const Letter FILENAME_END = 256;
     const Letter ONE_MORE_FILE = 257;
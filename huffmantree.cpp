@@ -5,237 +5,192 @@
 
 namespace Huffman {
     HuffmanTree::HuffmanTree() {
-        root_ = nullptr;
-        active_node_ = nullptr;
     }
 
-    HuffmanTree::~HuffmanTree() {
-        delete root_;
-    }
-
-    std::vector<HuffmanTree::EncodedChar> HuffmanTree::GetEncodedChars(const std::vector<size_t>& char_count) {
-        HuffmanTree::NodeHeap node_heap;
+    HuffmanTree::CodeTable HuffmanTree::GetEncodedChars(const std::vector<size_t>& char_count) {
+        std::vector<std::pair<size_t, Letter>> leaves;
         for (Letter i = 0; i < char_count.size(); ++i) {
             if (char_count[i] > 0) {
-                node_heap.Push(new Node(i, char_count[i]));
+                leaves.push_back({ char_count[i], i });
+            }
+        }
+        if (leaves.empty()) {
+            return CodeTable{};
+        }
+        std::sort(leaves.begin(), leaves.end());
+
+        // Merged nodes are created in non-decreasing weight order, so the two lightest nodes are always at the
+        // fronts of the leaf queue and the merged queue. parent[] covers leaves first, then merged nodes; a
+        // node's parent always has a larger index, so depths follow from one backward pass.
+        size_t leaf_count = leaves.size();
+        std::vector<size_t> weight(2 * leaf_count - 1);
+        std::vector<size_t> parent(2 * leaf_count - 1, 0);
+        for (size_t i = 0; i < leaf_count; ++i) {
+            weight[i] = leaves[i].first;
+        }
+        size_t next_leaf = 0;
+        size_t next_merged = leaf_count;
+        for (size_t merged = leaf_count; merged < weight.size(); ++merged) {
+            size_t children[2];
+            for (size_t& child : children) {
+                if (next_leaf < leaf_count && (next_merged == merged || weight[next_leaf] <= weight[next_merged])) {
+                    child = next_leaf++;
+                } else {
+                    child = next_merged++;
+                }
             }
+            weight[merged] = weight[children[0]] + weight[children[1]];
+            parent[children[0]] = merged;
+            parent[children[1]] = merged;
         }
-        BuildTreeWithHeap(node_heap);
+
+        std::vector<size_t>& depth = weight;
+        depth.back() = 0;
+        for (size_t node = depth.size() - 1; node-- > 0;) {
+            depth[node] = depth[parent[node]] + 1;
+        }
+
         std::vector<std::pair<size_t, Letter>> char_codelen;
-        FindCharCodeLength(char_codelen);
+        for (size_t i = 0; i < leaf_count; ++i) {
+            char_codelen.push_back({ std::max<size_t>(depth[i], 1), leaves[i].second });
+        }
         std::sort(char_codelen.begin(), char_codelen.end());
         return GetCanonicalHuffmanCodes(char_codelen);
     }
 
-    void HuffmanTree::BuildTreeWithLeaves(std::vector<std::pair<size_t, Letter>> char_codelen) {
-        std::vector<EncodedChar> leaves = GetCanonicalHuffmanCodes(char_codelen);
-        delete root_;
-        root_ = new Node();
-        for (const auto& leaf : leaves) {
-            AddLeaf(leaf);
+    HuffmanTree::CodeTable HuffmanTree::GetLengthLimitedCodes(const std::vector<size_t>& char_count, size_t max_code_length) {
+        std::vector<std::pair<size_t, Letter>> leaves;
+        for (Letter i = 0; i < char_count.size(); ++i) {
+            if (char_count[i] > 0) {
+                leaves.push_back({ char_count[i], i });
+            }
         }
-        active_node_ = root_;
-    }
-
-    std::optional<Letter> HuffmanTree::NextNode(bool to_right) {
-        if (active_node_->GetLeft() == nullptr && active_node_->GetRight() == nullptr) {
-            active_node_ = root_;
+        if (max_code_length == 0 || max_code_length > Huffman::MAX_CODE_LENGTH ||
+            leaves.size() > (static_cast<size_t>(1) << max_code_length)) {
+            throw std::runtime_error("GetLengthLimitedCodes: code length limit is too small");
         }
-        if (to_right) {
-            if (active_node_->GetRight() == nullptr) {
-                throw std::runtime_error("NextNode: GetRight nullptr exception");
+        std::sort(leaves.begin(), leaves.end());
+
+        // levels[k] holds the items of the k-th list in ascending weight order: a leaf index, or
+        // SYMBOLS_COUNT for a package of two consecutive items of levels[k - 1].
+        std::vector<std::vector<size_t>> levels(max_code_length);
+        std::vector<size_t> weights;
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            levels[0].push_back(i);
+            weights.push_back(leaves[i].first);
+        }
+        for (size_t level = 1; level < max_code_length; ++level) {
+            std::vector<size_t> package_weights;
+            for (size_t i = 0; i + 1 < weights.size(); i += 2) {
+                package_weights.push_back(weights[i] + weights[i + 1]);
             }
-            active_node_ = active_node_->GetRight();
-        } else {
-            if (active_node_->GetLeft() == nullptr) {
-                throw std::runtime_error("NextNode: GetLeft nullptr exception");
+            std::vector<size_t> merged_weights;
+            size_t leaf = 0;
+            size_t package = 0;
+            while (leaf < leaves.size() || package < package_weights.size()) {
+                if (package == package_weights.size() || (leaf < leaves.size() && leaves[leaf].first <= package_weights[package])) {
+                    levels[level].push_back(leaf);
+                    merged_weights.push_back(leaves[leaf].first);
+                    ++leaf;
+                } else {
+                    levels[level].push_back(Huffman::SYMBOLS_COUNT);
+                    merged_weights.push_back(package_weights[package]);
+                    ++package;
+                }
             }
-            active_node_ = active_node_->GetLeft();
+            weights = std::move(merged_weights);
         }
-        if (active_node_->GetLeft() == nullptr && active_node_->GetRight() == nullptr) {
-            return active_node_->GetChar();
-        } else {
-            return std::nullopt;
-        }
-    }
-
-    HuffmanTree::Node::Node() {
-        this->char_ = 0;
-        this->left_ = nullptr;
-        this->right_ = nullptr;
-        this->priority_ = 0;
-    }
-
-    HuffmanTree::Node::Node(Letter char_value, size_t priority) {
-        this->char_ = char_value;
-        this->left_ = nullptr;
-        this->right_ = nullptr;
-        this->priority_ = priority;
-    }
-
-    HuffmanTree::Node::Node(Node* left, Node* right) {
-        this->char_ = 0;
-        this->left_ = left;
-        this->right_ = right;
-        this->priority_ = left->GetPriority() + right->GetPriority();
-    }
-
-    HuffmanTree::Node::~Node() {
-        delete left_;
-        delete right_;
-    }
-
-    HuffmanTree::Node* HuffmanTree::Node::GetLeft() const {
-        return left_;
-    }
-
-    HuffmanTree::Node* HuffmanTree::Node::GetRight() const {
-        return right_;
-    }
-
-    size_t HuffmanTree::Node::GetChar() const {
-        return char_;
-    }
 
-    size_t HuffmanTree::Node::GetPriority() const {
-        return priority_;
-    }
-
-    HuffmanTree::Node* HuffmanTree::Node::GoLeft() {
-        if (left_ == nullptr) {
-            left_ = new Node();
+        // The code length of a symbol is the number of selected items it appears in. Packages among the
+        // first selected items of a list select a prefix of the previous list.
+        std::vector<size_t> codelen(leaves.size(), 0);
+        size_t selected = leaves.size() > 1 ? 2 * leaves.size() - 2 : 0;
+        for (size_t level = max_code_length; level-- > 0;) {
+            size_t packages = 0;
+            for (size_t i = 0; i < selected; ++i) {
+                if (levels[level][i] == Huffman::SYMBOLS_COUNT) {
+                    ++packages;
+                } else {
+                    ++codelen[levels[level][i]];
+                }
+            }
+            selected = 2 * packages;
         }
-        return left_;
-    }
 
-    HuffmanTree::Node* HuffmanTree::Node::GoRight() {
-        if (right_ == nullptr) {
-            right_ = new Node();
+        std::vector<std::pair<size_t, Letter>> char_codelen;
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            char_codelen.push_back({ std::max<size_t>(codelen[i], 1), leaves[i].second });
         }
-        return right_;
-    }
-
-    void HuffmanTree::Node::SetChar(Letter char_value) {
-        char_ = char_value;
-    }
-
-    bool HuffmanTree::Node::operator<(const HuffmanTree::Node& other) const {
-        return this->GetPriority() < other.GetPriority();
-    }
-
-    HuffmanTree::Node* HuffmanTree::Merge(Node* left, Node* right) {
-        return new Node(left, right);
+        std::sort(char_codelen.begin(), char_codelen.end());
+        return GetCanonicalHuffmanCodes(char_codelen);
     }
 
-    void HuffmanTree::NodeHeap::Push(HuffmanTree::Node* node) {
-        heap_.push_back(node);
-        size_t index = heap_.size() - 1;
-        while (index != 0 && *heap_[index] < *heap_[ParentIndex(index)]) {
-            std::swap(heap_[index], heap_[ParentIndex(index)]);
-            index = ParentIndex(index);
+    void HuffmanTree::BuildTreeWithLeaves(std::vector<std::pair<size_t, Letter>> char_codelen) {
+        CodeTable leaves = GetCanonicalHuffmanCodes(char_codelen);
+        nodes_.clear();
+        // A complete prefix code over n symbols has exactly 2n - 1 nodes.
+        nodes_.reserve(2 * char_codelen.size());
+        nodes_.push_back({ { 0, 0 }, 0 });
+        for (const auto& [codelen, char_value] : char_codelen) {
+            AddLeaf(leaves[char_value]);
         }
     }
 
-    void HuffmanTree::NodeHeap::Pop() {
-        std::swap(heap_.front(), heap_.back());
-        heap_.pop_back();
-        size_t index = 0;
-        while (LeftChildIndex(index) < heap_.size()) {
-            if (RightChildIndex(index) < heap_.size() && *heap_[RightChildIndex(index)] < *heap_[index] &&
-                *heap_[RightChildIndex(index)] < *heap_[LeftChildIndex(index)]) {
-                std::swap(heap_[index], heap_[RightChildIndex(index)]);
-                index = RightChildIndex(index);
-            } else if (*heap_[LeftChildIndex(index)] < *heap_[index]) {
-                std::swap(heap_[index], heap_[LeftChildIndex(index)]);
-                index = LeftChildIndex(index);
-            } else {
-                break;
-            }
+    std::optional<Letter> HuffmanTree::NextNode(size_t& node, bool to_right) const {
+        if (IsLeaf(node)) {
+            node = 0;
+        }
+        size_t next_node = nodes_[node].children[to_right];
+        if (next_node == 0) {
+            throw std::runtime_error(to_right ? "NextNode: GetRight nullptr exception" : "NextNode: GetLeft nullptr exception");
+        }
+        node = next_node;
+        if (IsLeaf(node)) {
+            return nodes_[node].char_value;
+        } else {
+            return std::nullopt;
         }
     }
 
-    HuffmanTree::Node* HuffmanTree::NodeHeap::GetMin() const {
-        return heap_.front();
-    }
-
-    size_t HuffmanTree::NodeHeap::Size() const {
-        return heap_.size();
-    }
-
-    size_t HuffmanTree::NodeHeap::ParentIndex(size_t index) const {
-        return (index - 1) / 2;
-    }
-
-    size_t HuffmanTree::NodeHeap::LeftChildIndex(size_t index) const {
-        return index * 2 + 1;
-    }
-
-    size_t HuffmanTree::NodeHeap::RightChildIndex(size_t index) const {
-        return index * 2 + 2;
-    }
-
-    void HuffmanTree::BuildTreeWithHeap(NodeHeap& node_heap) {
-        while (node_heap.Size() > 1) {
-            Node* A = node_heap.GetMin();
-            node_heap.Pop();
-            Node* B = node_heap.GetMin();
-            node_heap.Pop();
-            Node* C = Merge(A, B);
-            node_heap.Push(C);
-        }
-        delete root_;
-        root_ = node_heap.GetMin();
-    }
-
-    void HuffmanTree::FindCharCodeLength(std::vector<std::pair<size_t, Letter>>& char_codelen) {
-        std::queue<std::pair<Node*, size_t>> bfs_queue;
-        bfs_queue.push({ root_, 0 });
-        while (!bfs_queue.empty()) {
-            auto node = bfs_queue.front();
-            bfs_queue.pop();
-            if (node.first->GetLeft() == nullptr && node.first->GetRight() == nullptr) {
-                char_codelen.push_back({ node.second, node.first->GetChar() });
-            } else {
-                bfs_queue.push({ node.first->GetLeft(), node.second + 1 });
-                bfs_queue.push({ node.first->GetRight(), node.second + 1 });
-            }
-        }
+    bool HuffmanTree::IsLeaf(size_t node) const {
+        return nodes_[node].children[0] == 0 && nodes_[node].children[1] == 0;
     }
 
-    std::vector<HuffmanTree::EncodedChar> HuffmanTree::GetCanonicalHuffmanCodes(std::vector<std::pair<size_t, Letter>>& char_codelen) {
-        std::vector<EncodedChar> encoded_chars;
-        Huffman::Code code(char_codelen[0].first, 0);
+    HuffmanTree::CodeTable HuffmanTree::GetCanonicalHuffmanCodes(const std::vector<std::pair<size_t, Letter>>& char_codelen) {
+        CodeTable encoded_chars{};
+        uint64_t code = 0;
         for (size_t i = 0; i < char_codelen.size(); ++i) {
-            encoded_chars.push_back({ char_codelen[i].second, char_codelen[i].first, code });
-            if (i + 1 < char_codelen.size()) {
-                auto it = code.end();
-                --it;
-                while (*it) {
-                    if (it == code.begin()) {
-                        throw std::runtime_error("GetCanonicalHuffmanCodes code iterator exception");
-                    }
-                    *it = 0;
-                    --it;
-                }
-                *it = 1;
-                size_t shift = char_codelen[i + 1].first - char_codelen[i].first;
-                for (size_t j = 0; j < shift; ++j) {
-                    code.push_back(0);
+            size_t codelen = char_codelen[i].first;
+            if (codelen == 0 || codelen > Huffman::MAX_CODE_LENGTH || char_codelen[i].second >= Huffman::SYMBOLS_COUNT) {
+                throw std::runtime_error("GetCanonicalHuffmanCodes: invalid code length");
+            }
+            if (i > 0) {
+                size_t prev_codelen = char_codelen[i - 1].first;
+                ++code;
+                if (codelen < prev_codelen || (code >> prev_codelen) != 0) {
+                    throw std::runtime_error("GetCanonicalHuffmanCodes: code lengths do not form a prefix code");
                 }
+                code <<= (codelen - prev_codelen);
+            }
+            Huffman::Code reversed_code = 0;
+            for (size_t bit = 0; bit < codelen; ++bit) {
+                reversed_code ^= (((code >> bit) & 0b1) << (codelen - 1 - bit));
             }
+            encoded_chars[char_codelen[i].second] = { char_codelen[i].second, codelen, reversed_code };
         }
         return encoded_chars;
     }
 
     void HuffmanTree::AddLeaf(const EncodedChar& leaf) {
-        Node* current_node = root_;
+        size_t current_node = 0;
         for (size_t i = 0; i < leaf.codelen; ++i) {
-            if (leaf.code[i]) {
-                current_node = current_node->GoRight();
-            } else {
-                current_node = current_node->GoLeft();
+            size_t bit = (leaf.code >> i) & 0b1;
+            if (nodes_[current_node].children[bit] == 0) {
+                nodes_[current_node].children[bit] = static_cast<uint32_t>(nodes_.size());
+                nodes_.push_back({ { 0, 0 }, 0 });
             }
+            current_node = nodes_[current_node].children[bit];
         }
-        current_node->SetChar(leaf.char_value);
+        nodes_[current_node].char_value = leaf.char_value;
     }
 }
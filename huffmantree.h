@@ -1,7 +1,8 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <optional>
-#include <queue>
 #include <vector>
 
 #include "huffman_constants.h"
@@ -15,63 +16,31 @@ namespace Huffman {
             Huffman::Code code;
         };
 
+        // Indexed by Letter; letters without a code have codelen 0.
+        using CodeTable = std::array<EncodedChar, Huffman::SYMBOLS_COUNT>;
+
         explicit HuffmanTree();
-        ~HuffmanTree();
 
-        std::vector<EncodedChar> GetEncodedChars(const std::vector<size_t>& char_count);
+        // Optimal code lengths by the two-queue method over the sorted frequencies, in linear time after sorting.
+        static CodeTable GetEncodedChars(const std::vector<size_t>& char_count);
         void BuildTreeWithLeaves(std::vector<std::pair<size_t, Letter>> char_codelen);
-        std::optional<Letter> NextNode(bool to_right);
-
-    private:
-        class Node {
-        public:
-            explicit Node();
-            explicit Node(Letter char_value, size_t priority);
-            explicit Node(Node* left, Node* right);
-            ~Node();
-
-            Node* GetLeft() const;
-            Node* GetRight() const;
-            Letter GetChar() const;
-            size_t GetPriority() const;
-            Node* GoLeft();
-            Node* GoRight();
-            void SetChar(Letter char_value);
-
-            bool operator<(const Node& other) const;
-
-            friend class NodeHeap;
+        // Moves node, the caller's position in the tree, to a child; a walk starts at the root, node 0.
+        std::optional<Letter> NextNode(size_t& node, bool to_right) const;
 
-        private:
-            Letter char_;
-            size_t priority_;
-            Node* left_;
-            Node* right_;
-        };
-
-        Node* Merge(Node* left, Node* right);
-
-        class NodeHeap {
-        public:
-            void Push(Node* node);
-            void Pop();
-            Node* GetMin() const;
-            size_t Size() const;
+        static CodeTable GetCanonicalHuffmanCodes(const std::vector<std::pair<size_t, Letter>>& char_codelen);
+        // Optimal codes no longer than max_code_length bits, built with the package-merge algorithm.
+        static CodeTable GetLengthLimitedCodes(const std::vector<size_t>& char_count, size_t max_code_length);
 
-        private:
-            std::vector<Node*> heap_;
-
-            size_t ParentIndex(size_t index) const;
-            size_t LeftChildIndex(size_t index) const;
-            size_t RightChildIndex(size_t index) const;
+    private:
+        // Nodes live in one array with the root at index 0, so a child index of 0 means "no child".
+        struct Node {
+            uint32_t children[2];
+            Letter char_value;
         };
 
-        Node* root_;
-        Node* active_node_;
+        std::vector<Node> nodes_;
 
-        void BuildTreeWithHeap(NodeHeap& node_heap);
-        void FindCharCodeLength(std::vector<std::pair<size_t, Letter>>& char_codelen);
-        std::vector<EncodedChar> GetCanonicalHuffmanCodes(std::vector<std::pair<size_t, Letter>>& char_codelen);
+        bool IsLeaf(size_t node) const;
         void AddLeaf(const EncodedChar& leaf);
     };
 }
@@ -0,0 +1,111 @@
+#include "inputsource.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Huffman {
+    namespace {
+        const size_t SPOOL_CHUNK_SIZE = 1 << 16;
+
+        size_t ReadFromFd(int fd, char* data, size_t size) {
+            while (true) {
+                ssize_t read_count = ::read(fd, data, size);
+                if (read_count >= 0) {
+                    return read_count;
+                }
+                if (errno != EINTR) {
+                    throw std::runtime_error("InputSource: Read error.");
+                }
+            }
+        }
+    }
+
+    InputSource::InputSource(const std::string& file_name) {
+        mapping_ = nullptr;
+        mapping_size_ = 0;
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("InputSource: Cannot open file " + file_name + ".");
+        }
+        try {
+            struct stat file_stat;
+            if (::fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+                static_cast<size_t>(file_stat.st_size) >= MMAP_THRESHOLD) {
+                Map(fd, file_stat.st_size);
+            } else {
+                Spool([fd](char* data, size_t size) { return ReadFromFd(fd, data, size); });
+            }
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+    }
+
+    InputSource::~InputSource() {
+        if (mapping_ != nullptr) {
+            ::munmap(mapping_, mapping_size_);
+        }
+    }
+
+    const unsigned char* InputSource::Data() const {
+        return mapping_ != nullptr ? static_cast<const unsigned char*>(mapping_) : buffer_.data();
+    }
+
+    size_t InputSource::Size() const {
+        return mapping_ != nullptr ? mapping_size_ : buffer_.size();
+    }
+
+    void InputSource::Map(int fd, size_t size) {
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("InputSource: mmap failed.");
+        }
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        mapping_ = mapping;
+        mapping_size_ = size;
+    }
+
+    void InputSource::Spool(const std::function<size_t(char*, size_t)>& read_chunk) {
+        std::vector<char> chunk(SPOOL_CHUNK_SIZE);
+        size_t read_count;
+        while ((read_count = read_chunk(chunk.data(), chunk.size())) > 0) {
+            buffer_.insert(buffer_.end(), chunk.begin(), chunk.begin() + read_count);
+            if (buffer_.size() > SPOOL_MEMORY_LIMIT) {
+                break;
+            }
+        }
+        if (read_count == 0) {
+            return;
+        }
+
+        std::FILE* spill = std::tmpfile();
+        if (spill == nullptr) {
+            throw std::runtime_error("InputSource: Cannot create a temporary file.");
+        }
+        size_t size = buffer_.size();
+        bool written = std::fwrite(buffer_.data(), 1, buffer_.size(), spill) == buffer_.size();
+        std::vector<unsigned char>().swap(buffer_);
+        while (written && (read_count = read_chunk(chunk.data(), chunk.size())) > 0) {
+            written = std::fwrite(chunk.data(), 1, read_count, spill) == read_count;
+            size += read_count;
+        }
+        if (!written || std::fflush(spill) != 0) {
+            std::fclose(spill);
+            throw std::runtime_error("InputSource: Cannot write a temporary file.");
+        }
+        try {
+            Map(::fileno(spill), size);
+        } catch (...) {
+            std::fclose(spill);
+            throw;
+        }
+        std::fclose(spill);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Huffman {
+    const size_t MMAP_THRESHOLD = 1 << 20;
+    const size_t SPOOL_MEMORY_LIMIT = 64 << 20;
+
+    // Contents of one input, read exactly once so that counting and encoding share the same bytes.
+    // Regular files of at least MMAP_THRESHOLD bytes are memory-mapped. Smaller files and other inputs
+    // such as pipes are read into memory; a spool that outgrows SPOOL_MEMORY_LIMIT moves to an unlinked
+    // temporary file which is then mapped.
+    class InputSource {
+    public:
+        explicit InputSource(const std::string& file_name);
+        ~InputSource();
+
+        InputSource(const InputSource&) = delete;
+        InputSource& operator=(const InputSource&) = delete;
+
+        const unsigned char* Data() const;
+        size_t Size() const;
+
+    private:
+        std::vector<unsigned char> buffer_;
+        void* mapping_;
+        size_t mapping_size_;
+
+        void Map(int fd, size_t size);
+        void Spool(const std::function<size_t(char*, size_t)>& read_chunk);
+    };
+}
@@ -1,48 +1,333 @@
 #include <exception>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
 
 #include "coder.h"
+#include "threadpool.h"
+
+enum class StatsFormat {
+    NONE,
+    TEXT,
+    JSON,
+};
+
+struct Options {
+    size_t thread_count = 1;
+    Huffman::BlockOptions block_options;
+    StatsFormat stats = StatsFormat::NONE;
+    bool solid = false;
+    bool dedup = false;
+};
+
+// Collects --stats for one archive job and prints them to standard error once the job is done.
+class StatsReport {
+public:
+    explicit StatsReport(const Options& options) : timer_(options.stats != StatsFormat::NONE) {
+        format_ = options.stats;
+    }
+
+    Huffman::ArchiveStats* Get() {
+        return format_ != StatsFormat::NONE ? &stats_ : nullptr;
+    }
 
-void CreateArchive(int file_count, const char* file_names[]) {
-    std::ofstream out(std::string(file_names[2]), std::ios::binary);
-    Huffman::Encoder encoder(out);
-    for (int i = 3; i < file_count; ++i) {
-        std::ifstream in(std::string(file_names[i]), std::ios::binary);
-        encoder.EncodeFile(in, std::string(file_names[i]));
-        in.close();
+    void Print() {
+        if (format_ == StatsFormat::NONE) {
+            return;
+        }
+        stats_.total_seconds = timer_.Lap();
+        if (format_ == StatsFormat::JSON) {
+            Huffman::PrintStatsJson(stats_, std::cerr);
+        } else {
+            Huffman::PrintStats(stats_, std::cerr);
+        }
     }
+
+private:
+    StatsFormat format_;
+    Huffman::PhaseTimer timer_;
+    Huffman::ArchiveStats stats_;
+};
+
+// Encoder payload growth caused by --max-code-length, printed to out.
+void PrintLengthLimitCost(const Huffman::Encoder& encoder, const Options& options, std::ostream& out) {
+    if (options.block_options.max_code_length >= Huffman::MAX_CODE_LENGTH) {
+        return;
+    }
+    uint64_t cost = encoder.LengthLimitBits();
+    uint64_t unlimited = encoder.PayloadBits() - cost;
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3) << "Code lengths limited to " << options.block_options.max_code_length << " bits: +" << (cost + 7) / 8
+        << " bytes (" << (unlimited > 0 ? 100.0 * cost / unlimited : 0.0) << "% of the payload)." << std::endl;
+    out.flags(flags);
+}
+
+// An archive named "-" is written to standard output; status messages then go to standard error.
+void CreateArchive(const std::string& archive_name, const std::vector<std::string>& file_names, const Options& options) {
+    StatsReport stats(options);
+    if (archive_name == "-") {
+        {
+            Huffman::Encoder encoder(std::cout, options.thread_count, options.block_options);
+            encoder.SetStats(stats.Get());
+            encoder.SetDeduplication(options.dedup);
+            if (options.solid) {
+                encoder.WriteSharedTable(file_names);
+            }
+            encoder.EncodeFiles(file_names);
+            PrintLengthLimitCost(encoder, options, std::cerr);
+        }
+        std::cout.flush();
+        if (!std::cout) {
+            throw std::runtime_error("Cannot write archive to standard output.");
+        }
+        stats.Print();
+        std::cerr << "Archive created successfully!" << std::endl;
+        return;
+    }
+    std::ofstream out(archive_name, std::ios::binary);
+    {
+        Huffman::Encoder encoder(out, options.thread_count, options.block_options);
+        encoder.SetStats(stats.Get());
+        encoder.SetDeduplication(options.dedup);
+        if (options.solid) {
+            encoder.WriteSharedTable(file_names);
+        }
+        encoder.EncodeFiles(file_names);
+        PrintLengthLimitCost(encoder, options, std::cout);
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write archive " + archive_name + ".");
+    }
+    stats.Print();
     std::cout << "Archive created successfully!" << std::endl;
 }
 
-void ExtractFiles(const char* archive_name) {
-    std::ifstream in(std::string(archive_name), std::ios::binary);
-    Huffman::Decoder decoder(in);
+// Only the new files are encoded; they replace the old index, and the new index repeats every entry of the old
+// one. All inputs are checked to be readable before the archive is touched. If encoding still fails, the
+// encoder indexes the members written in full and the archive is cut after that index.
+void AppendFiles(const std::string& archive_name, const std::vector<std::string>& file_names, const Options& options) {
+    for (const auto& file_name : file_names) {
+        // Not opened: a pipe would lose its writer to a check.
+        if (file_name != "-" && ::access(file_name.c_str(), R_OK) != 0) {
+            throw std::runtime_error("Cannot open file " + file_name + ".");
+        }
+    }
+    std::fstream archive(archive_name, std::ios::in | std::ios::out | std::ios::binary);
+    if (!archive) {
+        throw std::runtime_error("Cannot open archive " + archive_name + ".");
+    }
+    uint64_t index_offset;
+    std::vector<Huffman::MemberInfo> members = Huffman::Decoder(archive).ListFiles(index_offset);
+    archive.clear();
+    archive.seekp(index_offset);
+    StatsReport stats(options);
+    try {
+        Huffman::Encoder encoder(archive, members, index_offset, options.thread_count, options.block_options);
+        encoder.SetStats(stats.Get());
+        encoder.SetDeduplication(options.dedup);
+        if (options.solid) {
+            encoder.WriteSharedTable(file_names);
+        }
+        encoder.EncodeFiles(file_names);
+        PrintLengthLimitCost(encoder, options, std::cout);
+    } catch (...) {
+        std::streamoff archive_size = archive.tellp();
+        archive.close();
+        if (archive_size > 0) {
+            std::filesystem::resize_file(archive_name, archive_size);
+        }
+        throw;
+    }
+    archive.close();
+    if (!archive) {
+        throw std::runtime_error("Cannot write archive " + archive_name + ".");
+    }
+    stats.Print();
+    std::cout << "Files appended successfully!" << std::endl;
+}
+
+// An archive named "-" is read from standard input and the contents of its members go to standard output.
+void ExtractFiles(const std::string& archive_name, const Options& options) {
+    StatsReport stats(options);
+    if (archive_name == "-") {
+        Huffman::Decoder decoder(std::cin, options.thread_count);
+        decoder.SetStats(stats.Get());
+        decoder.DecodeStream(std::cout);
+        stats.Print();
+        std::cerr << "Files extracted successfully!" << std::endl;
+        return;
+    }
+    std::ifstream in(archive_name, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open archive " + archive_name + ".");
+    }
+    Huffman::Decoder decoder(in, options.thread_count);
+    decoder.SetStats(stats.Get());
     decoder.DecodeFiles();
     in.close();
+    stats.Print();
     std::cout << "Files extracted successfully!" << std::endl;
 }
 
+void ExtractSelectedFiles(const std::string& archive_name, const std::vector<std::string>& file_names, const Options& options) {
+    std::ifstream in(archive_name, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open archive " + archive_name + ".");
+    }
+    StatsReport stats(options);
+    Huffman::Decoder decoder(in, options.thread_count);
+    decoder.SetStats(stats.Get());
+    decoder.DecodeFiles(file_names);
+    in.close();
+    stats.Print();
+    std::cout << "Files extracted successfully!" << std::endl;
+}
+
+void ListFiles(const std::string& archive_name) {
+    std::ifstream in(archive_name, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open archive " + archive_name + ".");
+    }
+    Huffman::Decoder decoder(in);
+    for (const auto& member : decoder.ListFiles()) {
+        std::cout << member.size << '\t' << member.name << std::endl;
+    }
+}
+
 void PrintHelp() {
     std::cout << "HELP:" << std::endl;
-    std::cout << "-c archive_name file1 [file2 ...] - to archive files file1, file2, ... and save result in file archive_name." << std::endl;
-    std::cout << "-d archive_name - unarchive files from archive archive_name and put in the current directory." << std::endl;
+    std::cout << "-c [-j N] archive_name file1 [file2 ...] - to archive files file1, file2, ... and save result in file archive_name. Use - to archive standard input." << std::endl;
+    std::cout << "-c [-j N] - [file1 ...] - to write the archive to standard output; without files standard input is archived." << std::endl;
+    std::cout << "-a [-j N] archive_name file1 [file2 ...] - to add files file1, file2, ... to the existing archive archive_name." << std::endl;
+    std::cout << "-d [-j N] archive_name - unarchive files from archive archive_name and put in the current directory." << std::endl;
+    std::cout << "-d [-j N] - - to read an archive from standard input and write the contents of its files to standard output." << std::endl;
+    std::cout << "    Archives made with --dedup are only read from a redirected file, not from a pipe." << std::endl;
+    std::cout << "-x [-j N] archive_name file1 [file2 ...] - unarchive only files file1, file2, ... from archive archive_name." << std::endl;
+    std::cout << "-l archive_name - list files in archive archive_name with their sizes." << std::endl;
     std::cout << "-h - to display help on using the program." << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "-j N - use N threads (0 - one per CPU core)." << std::endl;
+    std::cout << "--stats[=json] - print per-file timings and code statistics to standard error, as text or JSON." << std::endl;
+    std::cout << "--max-code-length N - with -c or -a, limit Huffman codes to N bits (8-" << Huffman::MAX_CODE_LENGTH << ")." << std::endl;
+    std::cout << "--preset text|json|log|auto - with -c or -a, code files with a built-in table instead of their own;" << std::endl;
+    std::cout << "    auto lets every block choose a built-in table only where it is the smallest;" << std::endl;
+    std::cout << "    needs --max-code-length of at least " << Huffman::PRESET_MAX_CODE_LENGTH << "." << std::endl;
+    std::cout << "--sample - with -c or -a, build the code of every block from a sample of it instead of counting all its bytes;" << std::endl;
+    std::cout << "    not combined with --preset, --context-model or --solid." << std::endl;
+    std::cout << "--context-model - with -c or -a, code bytes with tables chosen by the previous byte where that pays off." << std::endl;
+    std::cout << "--dedup - with -c or -a, store files identical to an earlier one as references to it." << std::endl;
+    std::cout << "--solid - with -c or -a, build one code table from all files and share it between their blocks." << std::endl;
+    std::cout << "--single-stream - with -c or -a, code each block as one bit stream instead of four interleaved ones." << std::endl;
 }
 
 void InvalidInput() {
     std::cout << "Invalid input. Please use -h to display help on using the program." << std::endl;
 }
 
+bool ParseNumber(const std::string& value, size_t& number) {
+    if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    number = std::stoul(value);
+    return true;
+}
+
+// Consumes the options following the mode flag; arg_index is left at the first positional argument.
+bool ParseOptions(int argc, const char* argv[], int& arg_index, Options& options) {
+    while (arg_index < argc) {
+        std::string arg(argv[arg_index]);
+        if (arg == "-j" && arg_index + 1 < argc) {
+            if (!ParseNumber(argv[arg_index + 1], options.thread_count)) {
+                return false;
+            }
+            if (options.thread_count == 0) {
+                options.thread_count = Huffman::ThreadPool::DefaultThreadCount();
+            }
+            arg_index += 2;
+        } else if (arg == "--max-code-length" && arg_index + 1 < argc) {
+            size_t& max_code_length = options.block_options.max_code_length;
+            if (!ParseNumber(argv[arg_index + 1], max_code_length) || max_code_length < Huffman::BYTE_SIZE ||
+                max_code_length > Huffman::MAX_CODE_LENGTH) {
+                return false;
+            }
+            arg_index += 2;
+        } else if (arg == "--preset" && arg_index + 1 < argc) {
+            if (!Huffman::ParsePreset(argv[arg_index + 1], options.block_options.preset)) {
+                return false;
+            }
+            arg_index += 2;
+        } else if (arg == "--sample") {
+            options.block_options.sample = true;
+            ++arg_index;
+        } else if (arg == "--context-model") {
+            options.block_options.context_model = true;
+            ++arg_index;
+        } else if (arg == "--dedup") {
+            options.dedup = true;
+            ++arg_index;
+        } else if (arg == "--solid") {
+            options.solid = true;
+            ++arg_index;
+        } else if (arg == "--single-stream") {
+            options.block_options.interleave = false;
+            ++arg_index;
+        } else if (arg == "--stats" || arg == "--stats=text") {
+            options.stats = StatsFormat::TEXT;
+            ++arg_index;
+        } else if (arg == "--stats=json") {
+            options.stats = StatsFormat::JSON;
+            ++arg_index;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return false;
+        } else {
+            break;
+        }
+    }
+    // A sampled block never sees all its bytes, which the other ways of choosing a table rely on.
+    const Huffman::BlockOptions& block_options = options.block_options;
+    if (block_options.sample && (block_options.context_model || options.solid || block_options.preset != Huffman::Preset::NONE)) {
+        return false;
+    }
+    // Preset codes are longer than a lower limit allows, so the preset would never be used.
+    return block_options.preset == Huffman::Preset::NONE || block_options.max_code_length >= Huffman::PRESET_MAX_CODE_LENGTH;
+}
+
 int main(int argc, const char* argv[]) {
+    std::ios::sync_with_stdio(false);
     try {
-        if (argc >= 4 && std::string(argv[1]) == "-c") {
-            CreateArchive(argc, argv);
-        } else if (argc >= 3 && std::string(argv[1]) == "-d") {
-            ExtractFiles(argv[2]);
-        } else if (argc >= 2 && std::string(argv[1]) == "-h") {
+        std::string mode = argc >= 2 ? std::string(argv[1]) : std::string();
+        int arg_index = 2;
+        Options options;
+        if (mode == "-h") {
             PrintHelp();
+        } else if (mode == "-c" && ParseOptions(argc, argv, arg_index, options) && argc - arg_index >= 1) {
+            std::string archive_name(argv[arg_index]);
+            std::vector<std::string> file_names(argv + arg_index + 1, argv + argc);
+            if (file_names.empty() && archive_name == "-") {
+                file_names.push_back("-");
+            }
+            if (file_names.empty()) {
+                InvalidInput();
+            } else {
+                CreateArchive(archive_name, file_names, options);
+            }
+        } else if (mode == "-a" && ParseOptions(argc, argv, arg_index, options) && argc - arg_index >= 2) {
+            std::vector<std::string> file_names(argv + arg_index + 1, argv + argc);
+            AppendFiles(argv[arg_index], file_names, options);
+        } else if (mode == "-d" && ParseOptions(argc, argv, arg_index, options) && argc - arg_index == 1) {
+            ExtractFiles(argv[arg_index], options);
+        } else if (mode == "-x" && ParseOptions(argc, argv, arg_index, options) && argc - arg_index >= 2) {
+            std::vector<std::string> file_names(argv + arg_index + 1, argv + argc);
+            ExtractSelectedFiles(argv[arg_index], file_names, options);
+        } else if (mode == "-l" && argc == 3) {
+            ListFiles(argv[2]);
         } else {
             InvalidInput();
         }
@@ -0,0 +1,115 @@
+#include "outputfile.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace Huffman {
+    namespace {
+        const size_t COPY_CHUNK_SIZE = 1 << 20;
+    }
+
+    OutputFile::OutputFile(const std::string& file_name, uint64_t size_hint) : file_name_(file_name) {
+        fd_ = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd_ < 0) {
+            throw std::runtime_error("OutputFile: Cannot create file " + file_name + ".");
+        }
+#ifdef __linux__
+        // Best effort: filesystems without fallocate support simply grow the file on write.
+        if (size_hint > 0) {
+            ::fallocate(fd_, 0, 0, size_hint);
+        }
+#endif
+    }
+
+    OutputFile::~OutputFile() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    void OutputFile::Close() {
+        // Not retried on EINTR: Linux releases the descriptor either way.
+        int result = ::close(fd_);
+        fd_ = -1;
+        if (result != 0) {
+            throw std::runtime_error("OutputFile: Cannot write file " + file_name_ + ".");
+        }
+    }
+
+    void OutputFile::WriteAt(const char* data, size_t size, uint64_t offset) {
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd_, data, size, offset);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("OutputFile: Cannot write file " + file_name_ + ".");
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+    }
+
+    void OutputFile::CopyFrom(const std::string& source_name) {
+        int source = ::open(source_name.c_str(), O_RDONLY);
+        if (source < 0) {
+            throw std::runtime_error("OutputFile: Cannot read file " + source_name + ".");
+        }
+        try {
+            uint64_t offset = 0;
+#ifdef __linux__
+            if (::ioctl(fd_, FICLONE, source) == 0) {
+                ::close(source);
+                return;
+            }
+            // Filesystems or kernels without copy_file_range fail on the first call; then the data is copied here.
+            while (true) {
+                ssize_t copied = ::copy_file_range(source, nullptr, fd_, nullptr, COPY_CHUNK_SIZE, 0);
+                if (copied < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (copied < 0 && offset > 0) {
+                    throw std::runtime_error("OutputFile: Cannot write file " + file_name_ + ".");
+                }
+                if (copied <= 0) {
+                    break;
+                }
+                offset += copied;
+            }
+            if (offset > 0) {
+                ::close(source);
+                return;
+            }
+#endif
+            std::vector<char> buffer(COPY_CHUNK_SIZE);
+            while (true) {
+                ssize_t size = ::pread(source, buffer.data(), buffer.size(), offset);
+                if (size < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (size < 0) {
+                    throw std::runtime_error("OutputFile: Cannot read file " + source_name + ".");
+                }
+                if (size == 0) {
+                    break;
+                }
+                WriteAt(buffer.data(), size, offset);
+                offset += size;
+            }
+        } catch (...) {
+            ::close(source);
+            throw;
+        }
+        ::close(source);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Huffman {
+    // Output file written with positioned writes, so that blocks decoded on different threads
+    // can be stored in any order. The file is preallocated to size_hint bytes when it is known.
+    class OutputFile {
+    public:
+        explicit OutputFile(const std::string& file_name, uint64_t size_hint = 0);
+        ~OutputFile();
+
+        OutputFile(const OutputFile&) = delete;
+        OutputFile& operator=(const OutputFile&) = delete;
+
+        void WriteAt(const char* data, size_t size, uint64_t offset);
+        // Fills the file with the contents of source_name. On Linux the file shares the extents of
+        // source_name where the filesystem supports reflinks, and is otherwise copied by the kernel.
+        void CopyFrom(const std::string& source_name);
+        // Closes the file and throws if that reports an error, such as a write that failed late on a
+        // network filesystem. The destructor closes a file that is still open without checking.
+        void Close();
+
+    private:
+        std::string file_name_;
+        int fd_;
+    };
+}
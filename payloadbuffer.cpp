@@ -0,0 +1,73 @@
+#include "payloadbuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Huffman {
+    PayloadOverflow::PayloadOverflow() : std::runtime_error("PayloadBuffer: Output buffer is too small.") {
+    }
+
+    PayloadBuffer::PayloadBuffer(std::vector<char>& out) {
+        vector_out_ = &out;
+        memory_out_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+    }
+
+    PayloadBuffer::PayloadBuffer(char* data, size_t capacity) {
+        vector_out_ = nullptr;
+        memory_out_ = data;
+        size_ = 0;
+        capacity_ = capacity;
+    }
+
+    char* PayloadBuffer::Data() {
+        return vector_out_ != nullptr ? vector_out_->data() : memory_out_;
+    }
+
+    size_t PayloadBuffer::Size() const {
+        return vector_out_ != nullptr ? vector_out_->size() : size_;
+    }
+
+    size_t PayloadBuffer::Capacity() const {
+        return vector_out_ != nullptr ? vector_out_->max_size() : capacity_;
+    }
+
+    void PayloadBuffer::Resize(size_t size) {
+        if (vector_out_ != nullptr) {
+            vector_out_->resize(size);
+            return;
+        }
+        if (size > capacity_) {
+            throw PayloadOverflow();
+        }
+        if (size > size_) {
+            std::memset(memory_out_ + size_, 0, size - size_);
+        }
+        size_ = size;
+    }
+
+    void PayloadBuffer::Assign(const char* data, size_t size) {
+        if (vector_out_ != nullptr) {
+            vector_out_->assign(data, data + size);
+            return;
+        }
+        if (size > capacity_) {
+            throw PayloadOverflow();
+        }
+        std::copy(data, data + size, memory_out_);
+        size_ = size;
+    }
+
+    void PayloadBuffer::Append(const char* data, size_t size) {
+        if (vector_out_ != nullptr) {
+            vector_out_->insert(vector_out_->end(), data, data + size);
+            return;
+        }
+        if (size > capacity_ - size_) {
+            throw PayloadOverflow();
+        }
+        std::copy(data, data + size, memory_out_ + size_);
+        size_ += size;
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace Huffman {
+    // Thrown by a PayloadBuffer asked to grow past its capacity.
+    class PayloadOverflow : public std::runtime_error {
+    public:
+        PayloadOverflow();
+    };
+
+    // Destination of a block payload: a vector that grows as needed, or a caller's buffer of fixed
+    // capacity, which lets Compress code blocks straight into its output.
+    class PayloadBuffer {
+    public:
+        explicit PayloadBuffer(std::vector<char>& out);
+        explicit PayloadBuffer(char* data, size_t capacity);
+
+        char* Data();
+        size_t Size() const;
+        size_t Capacity() const;
+        // Keeps the first bytes up to the smaller size and zeros the rest.
+        void Resize(size_t size);
+        void Assign(const char* data, size_t size);
+        void Append(const char* data, size_t size);
+
+    private:
+        std::vector<char>* vector_out_;
+        char* memory_out_;
+        size_t size_;
+        size_t capacity_;
+    };
+}
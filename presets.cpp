@@ -0,0 +1,174 @@
+#include "presets.h"
+
+namespace Huffman {
+    namespace {
+        const size_t BYTE_VALUES = 256;
+
+        // Byte frequencies of sample corpora (license texts and READMEs, JSON documents, build and
+        // package manager logs) scaled to a total of about 2^16. Every byte value has a weight of at
+        // least 1, so any input can be coded.
+        constexpr std::array<uint16_t, BYTE_VALUES> TEXT_WEIGHTS = {
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 21, 1688, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            10393, 9, 280, 76, 28, 8, 4, 92, 183, 184, 263, 38, 434, 761, 975, 444,
+            400, 268, 317, 139, 79, 73, 65, 57, 68, 107, 308, 58, 103, 352, 120, 10,
+            44, 467, 140, 309, 220, 489, 236, 176, 168, 497, 23, 31, 355, 182, 379, 378,
+            214, 12, 439, 410, 544, 189, 52, 108, 31, 104, 5, 46, 10, 46, 2, 168,
+            83, 2848, 761, 1531, 1543, 5030, 865, 897, 1506, 3182, 74, 348, 1608, 1197, 2776, 3046,
+            1050, 46, 2660, 2716, 3828, 1220, 379, 541, 206, 587, 45, 17, 19, 17, 2, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 4, 5, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        };
+
+        constexpr std::array<uint16_t, BYTE_VALUES> JSON_WEIGHTS = {
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 55, 2123, 1, 1, 483, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            18668, 4, 4657, 22, 24, 13, 15, 7, 11, 11, 19, 59, 1335, 517, 1693, 710,
+            539, 562, 374, 316, 296, 238, 203, 156, 133, 101, 1300, 3, 5, 87, 9, 3,
+            43, 234, 205, 284, 111, 114, 76, 80, 76, 121, 62, 57, 84, 155, 124, 93,
+            126, 62, 125, 235, 150, 82, 90, 70, 58, 56, 56, 141, 23, 141, 80, 219,
+            13, 1831, 550, 1190, 902, 3175, 475, 582, 678, 1855, 154, 234, 1171, 854, 1681, 1642,
+            1083, 98, 1803, 2072, 2222, 770, 296, 190, 247, 574, 115, 338, 8, 337, 10, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        };
+
+        constexpr std::array<uint16_t, BYTE_VALUES> LOG_WEIGHTS = {
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 15, 639, 1, 1, 15, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 13, 1, 1, 1, 1,
+            4161, 2, 142, 3, 6, 66, 3, 402, 50, 48, 20, 31, 86, 2006, 3303, 4261,
+            624, 1254, 766, 1005, 498, 427, 512, 301, 365, 246, 214, 21, 7, 92, 21, 1,
+            7, 543, 185, 360, 770, 505, 60, 106, 150, 443, 21, 42, 440, 490, 457, 332,
+            353, 2, 128, 891, 160, 90, 32, 175, 26, 25, 76, 100, 81, 89, 23, 1331,
+            2, 1251, 1117, 1479, 1006, 3162, 356, 693, 712, 2920, 62, 241, 1995, 939, 2813, 2955,
+            1874, 24, 2045, 2821, 3259, 827, 852, 78, 274, 1302, 51, 7, 38, 7, 159, 1,
+            8, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 4, 4, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 8, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        };
+
+        // Huffman code lengths by the two-queue method, clamped to PRESET_MAX_CODE_LENGTH; codes that got
+        // shorter are paid for by lengthening the longest codes still below the limit until the lengths
+        // satisfy the Kraft inequality again.
+        constexpr std::array<uint8_t, BYTE_VALUES> GetPresetCodeLengths(const std::array<uint16_t, BYTE_VALUES>& weights) {
+            std::array<size_t, BYTE_VALUES> order{};
+            for (size_t i = 0; i < BYTE_VALUES; ++i) {
+                size_t j = i;
+                while (j > 0 && weights[order[j - 1]] > weights[i]) {
+                    order[j] = order[j - 1];
+                    --j;
+                }
+                order[j] = i;
+            }
+            std::array<uint64_t, 2 * BYTE_VALUES> node_weights{};
+            std::array<size_t, 2 * BYTE_VALUES> parents{};
+            for (size_t i = 0; i < BYTE_VALUES; ++i) {
+                node_weights[i] = weights[order[i]];
+            }
+            size_t leaf = 0;
+            size_t node = BYTE_VALUES;
+            for (size_t next = BYTE_VALUES; next < 2 * BYTE_VALUES - 1; ++next) {
+                for (size_t child = 0; child < 2; ++child) {
+                    size_t lightest = leaf < BYTE_VALUES && (node == next || node_weights[leaf] <= node_weights[node]) ? leaf++ : node++;
+                    node_weights[next] += node_weights[lightest];
+                    parents[lightest] = next;
+                }
+            }
+            std::array<size_t, 2 * BYTE_VALUES> depths{};
+            for (size_t i = 2 * BYTE_VALUES - 2; i-- > 0;) {
+                depths[i] = depths[parents[i]] + 1;
+            }
+
+            std::array<uint8_t, BYTE_VALUES> lengths{};
+            uint64_t kraft_sum = 0;
+            for (size_t i = 0; i < BYTE_VALUES; ++i) {
+                size_t length = depths[i] < PRESET_MAX_CODE_LENGTH ? depths[i] : PRESET_MAX_CODE_LENGTH;
+                lengths[order[i]] = static_cast<uint8_t>(length);
+                kraft_sum += uint64_t(1) << (PRESET_MAX_CODE_LENGTH - length);
+            }
+            while (kraft_sum > (uint64_t(1) << PRESET_MAX_CODE_LENGTH)) {
+                size_t longest = BYTE_VALUES;
+                for (size_t i = 0; i < BYTE_VALUES; ++i) {
+                    if (lengths[i] < PRESET_MAX_CODE_LENGTH && (longest == BYTE_VALUES || lengths[i] > lengths[longest])) {
+                        longest = i;
+                    }
+                }
+                ++lengths[longest];
+                kraft_sum -= uint64_t(1) << (PRESET_MAX_CODE_LENGTH - lengths[longest]);
+            }
+            return lengths;
+        }
+
+        // Canonical codes in the order of WriteCodeLengths: by length, then by byte value.
+        constexpr PresetTable BuildPresetTable(const std::array<uint16_t, BYTE_VALUES>& weights) {
+            std::array<uint8_t, BYTE_VALUES> lengths = GetPresetCodeLengths(weights);
+            PresetTable table{};
+            uint64_t code = 0;
+            for (size_t length = 1; length <= PRESET_MAX_CODE_LENGTH; ++length) {
+                for (size_t value = 0; value < BYTE_VALUES; ++value) {
+                    if (lengths[value] != length) {
+                        continue;
+                    }
+                    Code reversed_code = 0;
+                    for (size_t bit = 0; bit < length; ++bit) {
+                        reversed_code |= ((code >> bit) & 1) << (length - 1 - bit);
+                    }
+                    table.encoded_chars[value] = { value, length, reversed_code };
+                    for (size_t high_bits = 0; high_bits < (size_t(1) << (PRESET_MAX_CODE_LENGTH - length)); ++high_bits) {
+                        table.decode_entries[reversed_code | (high_bits << length)] = { static_cast<uint8_t>(value),
+                            static_cast<uint8_t>(length) };
+                    }
+                    ++code;
+                }
+                code <<= 1;
+            }
+            return table;
+        }
+
+        constexpr std::array<PresetTable, PRESET_COUNT> PRESET_TABLES = {
+            BuildPresetTable(TEXT_WEIGHTS),
+            BuildPresetTable(JSON_WEIGHTS),
+            BuildPresetTable(LOG_WEIGHTS),
+        };
+    }
+
+    bool IsStoredPreset(Preset preset) {
+        return preset != Preset::NONE && static_cast<size_t>(preset) <= PRESET_COUNT;
+    }
+
+    const PresetTable& GetPresetTable(Preset preset) {
+        return PRESET_TABLES[static_cast<size_t>(preset) - 1];
+    }
+
+    bool ParsePreset(const std::string& name, Preset& preset) {
+        if (name == "text") {
+            preset = Preset::TEXT;
+        } else if (name == "json") {
+            preset = Preset::JSON;
+        } else if (name == "log") {
+            preset = Preset::LOG;
+        } else if (name == "auto") {
+            preset = Preset::AUTO;
+        } else {
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "huffmantree.h"
+
+namespace Huffman {
+    // Built-in code tables for common kinds of content. A block coded with a preset stores only its ID,
+    // so small inputs neither pay for a code table nor for building one.
+    enum class Preset : uint8_t {
+        NONE = 0,
+        TEXT = 1,
+        JSON = 2,
+        LOG = 3,
+        // Not stored in archives: every block picks the preset or table that codes it best.
+        AUTO = 0xFF,
+    };
+
+    const size_t PRESET_COUNT = 3;
+    const size_t PRESET_ID_BITS = 8;
+    const size_t PRESET_MAX_CODE_LENGTH = 12;
+
+    // A code of every byte value, and a table resolving any PRESET_MAX_CODE_LENGTH bits of input to the
+    // code they start with. Both are generated at compile time.
+    struct PresetTable {
+        struct DecodeEntry {
+            uint8_t value;
+            // 0 for bits that start no code.
+            uint8_t length;
+        };
+
+        HuffmanTree::CodeTable encoded_chars;
+        std::array<DecodeEntry, size_t(1) << PRESET_MAX_CODE_LENGTH> decode_entries;
+    };
+
+    bool IsStoredPreset(Preset preset);
+    // preset must satisfy IsStoredPreset.
+    const PresetTable& GetPresetTable(Preset preset);
+    // Parses "text", "json", "log" and "auto"; returns false for anything else.
+    bool ParsePreset(const std::string& name, Preset& preset);
+}
@@ -0,0 +1,146 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace Huffman {
+    namespace {
+        double PerByte(double bits, uint64_t size) {
+            return size > 0 ? bits / size : 0;
+        }
+
+        void PrintRow(const MemberStats& member, std::ostream& out) {
+            const BlockStats& blocks = member.blocks;
+            out << std::left << std::setw(24) << member.name << std::right << std::setw(12) << member.bytes_in << std::setw(12)
+                << member.bytes_out << std::setw(9) << blocks.histogram_seconds * 1000 << std::setw(9) << blocks.tree_seconds * 1000
+                << std::setw(9) << blocks.code_seconds * 1000 << std::setw(9) << blocks.io_seconds * 1000 << std::setw(9)
+                << PerByte(blocks.entropy_bits, blocks.raw_size) << std::setw(9) << PerByte(blocks.payload_bits, blocks.raw_size)
+                << std::setw(8) << blocks.max_code_length << std::endl;
+        }
+
+        // Size of the well-formed UTF-8 sequence starting at value[i], or 0 when there is none.
+        size_t Utf8SequenceSize(const std::string& value, size_t i) {
+            auto byte = [&](size_t j) {
+                return j < value.size() ? static_cast<unsigned char>(value[j]) : 0;
+            };
+            unsigned char lead = byte(i);
+            if (lead < 0xC2 || lead > 0xF4) {
+                return 0;
+            }
+            size_t size = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+            // Overlong forms, surrogates and code points past U+10FFFF are excluded by the second byte.
+            unsigned char low = lead == 0xE0 ? 0xA0 : lead == 0xF0 ? 0x90 : 0x80;
+            unsigned char high = lead == 0xED ? 0x9F : lead == 0xF4 ? 0x8F : 0xBF;
+            if (byte(i + 1) < low || byte(i + 1) > high) {
+                return 0;
+            }
+            for (size_t j = 2; j < size; ++j) {
+                if ((byte(i + j) & 0xC0) != 0x80) {
+                    return 0;
+                }
+            }
+            return size;
+        }
+
+        // File names are arbitrary bytes: well-formed UTF-8 is kept, other bytes are escaped as the code
+        // points of the same value.
+        void PrintJsonString(const std::string& value, std::ostream& out) {
+            out << '"';
+            for (size_t i = 0; i < value.size(); ++i) {
+                unsigned char c = static_cast<unsigned char>(value[i]);
+                size_t sequence_size = c >= 0x80 ? Utf8SequenceSize(value, i) : 1;
+                if (c == '"' || c == '\\') {
+                    out << '\\' << value[i];
+                } else if (c < 0x20 || sequence_size == 0) {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+                } else {
+                    out.write(value.data() + i, sequence_size);
+                    i += sequence_size - 1;
+                }
+            }
+            out << '"';
+        }
+
+        void PrintJsonMember(const MemberStats& member, std::ostream& out) {
+            const BlockStats& blocks = member.blocks;
+            out << "{\"name\": ";
+            PrintJsonString(member.name, out);
+            out << ", \"bytes_in\": " << member.bytes_in << ", \"bytes_out\": " << member.bytes_out
+                << ", \"histogram_seconds\": " << blocks.histogram_seconds << ", \"tree_seconds\": " << blocks.tree_seconds
+                << ", \"code_seconds\": " << blocks.code_seconds << ", \"io_seconds\": " << blocks.io_seconds
+                << ", \"entropy_bits_per_byte\": " << PerByte(blocks.entropy_bits, blocks.raw_size)
+                << ", \"coded_bits_per_byte\": " << PerByte(blocks.payload_bits, blocks.raw_size)
+                << ", \"max_code_length\": " << blocks.max_code_length
+                << ", \"sampling_cost_bytes\": " << blocks.sampling_cost_bits / 8 << "}";
+        }
+
+        MemberStats GetTotal(const ArchiveStats& stats) {
+            MemberStats total;
+            total.name = "total";
+            for (const auto& member : stats.members) {
+                total.bytes_in += member.bytes_in;
+                total.bytes_out += member.bytes_out;
+                total.Add(member.blocks);
+            }
+            return total;
+        }
+    }
+
+    void MemberStats::Add(const BlockStats& block) {
+        blocks.raw_size += block.raw_size;
+        blocks.payload_bits += block.payload_bits;
+        blocks.entropy_bits += block.entropy_bits;
+        blocks.max_code_length = std::max(blocks.max_code_length, block.max_code_length);
+        blocks.sampling_cost_bits += block.sampling_cost_bits;
+        blocks.histogram_seconds += block.histogram_seconds;
+        blocks.tree_seconds += block.tree_seconds;
+        blocks.code_seconds += block.code_seconds;
+        blocks.io_seconds += block.io_seconds;
+    }
+
+    double GetEntropyBits(const std::vector<size_t>& char_count) {
+        double total = 0;
+        for (size_t count : char_count) {
+            total += count;
+        }
+        double bits = 0;
+        for (size_t count : char_count) {
+            if (count > 0) {
+                bits -= count * std::log2(count / total);
+            }
+        }
+        return bits;
+    }
+
+    void PrintStats(const ArchiveStats& stats, std::ostream& out) {
+        std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(2);
+        out << std::left << std::setw(24) << "member" << std::right << std::setw(12) << "bytes in" << std::setw(12) << "bytes out"
+            << std::setw(9) << "hist ms" << std::setw(9) << "tree ms" << std::setw(9) << "code ms" << std::setw(9) << "io ms"
+            << std::setw(9) << "entropy" << std::setw(9) << "bits/B" << std::setw(8) << "max len" << std::endl;
+        for (const auto& member : stats.members) {
+            PrintRow(member, out);
+        }
+        MemberStats total = GetTotal(stats);
+        PrintRow(total, out);
+        if (total.blocks.sampling_cost_bits != 0) {
+            out << "Sampled code tables: " << std::showpos << total.blocks.sampling_cost_bits / 8 << std::noshowpos << " bytes ("
+                << 100.0 * total.blocks.sampling_cost_bits / (total.blocks.payload_bits - total.blocks.sampling_cost_bits)
+                << "% of the payload) over tables from all bytes." << std::endl;
+        }
+        out << "Phase times are summed over all threads; wall time " << stats.total_seconds * 1000 << " ms." << std::endl;
+        out.flags(flags);
+    }
+
+    void PrintStatsJson(const ArchiveStats& stats, std::ostream& out) {
+        out << "{\"wall_seconds\": " << stats.total_seconds << ", \"total\": ";
+        PrintJsonMember(GetTotal(stats), out);
+        out << ", \"members\": [";
+        for (size_t i = 0; i < stats.members.size(); ++i) {
+            out << (i > 0 ? ", " : "");
+            PrintJsonMember(stats.members[i], out);
+        }
+        out << "]}" << std::endl;
+    }
+}
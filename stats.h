@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Huffman {
+    // Measures consecutive phases of work; a disabled timer never reads the clock.
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(bool enabled) {
+            enabled_ = enabled;
+            if (enabled_) {
+                start_ = Clock::now();
+            }
+        }
+
+        // Seconds since construction or the previous Lap(), 0 when disabled.
+        double Lap() {
+            if (!enabled_) {
+                return 0;
+            }
+            Clock::time_point now = Clock::now();
+            double seconds = std::chrono::duration<double>(now - start_).count();
+            start_ = now;
+            return seconds;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        bool enabled_;
+        Clock::time_point start_;
+    };
+
+    struct BlockStats {
+        uint64_t raw_size = 0;
+        uint64_t payload_bits = 0;
+        // Order-0 Shannon entropy of the block's bytes, in bits for the whole block.
+        double entropy_bits = 0;
+        size_t max_code_length = 0;
+        // Payload bits of a sampled block over those of a code built from all its bytes; only measured
+        // with stats, since that needs the full histogram the sample avoids.
+        int64_t sampling_cost_bits = 0;
+        double histogram_seconds = 0;
+        double tree_seconds = 0;
+        double code_seconds = 0;
+        double io_seconds = 0;
+    };
+
+    struct MemberStats {
+        std::string name;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        // Sums over the member's blocks; max_code_length is the longest code of any block.
+        BlockStats blocks;
+
+        void Add(const BlockStats& block);
+    };
+
+    // Filled by Encoder and Decoder when they are given a non-null pointer; without one nothing is measured.
+    struct ArchiveStats {
+        std::vector<MemberStats> members;
+        double total_seconds = 0;
+    };
+
+    double GetEntropyBits(const std::vector<size_t>& char_count);
+
+    void PrintStats(const ArchiveStats& stats, std::ostream& out);
+    void PrintStatsJson(const ArchiveStats& stats, std::ostream& out);
+}
@@ -0,0 +1,46 @@
+# Adds files to an archive with ARCHIVER -a and extracts the result. A missing input is rejected before
+# the archive is touched. An input that fails once appending has started (a directory) keeps the files
+# before it: the archive is cut back after them and gets their index, so it lists and extracts cleanly. Run as:
+#   cmake -DARCHIVER=... -DWORK_DIR=... -P append.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/common.cmake")
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/in/directory" "${WORK_DIR}/out")
+
+set(files first.txt second.txt appended.txt before_failure.txt)
+foreach(name ${files})
+    string(REPEAT "${name} is a member of the archive\n" 500 content)
+    file(WRITE "${WORK_DIR}/in/${name}" "${content}")
+endforeach()
+
+run_archiver("${WORK_DIR}/in" -c "${WORK_DIR}/test.huf" first.txt second.txt)
+run_archiver("${WORK_DIR}/in" -a "${WORK_DIR}/test.huf" appended.txt)
+configure_file("${WORK_DIR}/test.huf" "${WORK_DIR}/appended.huf" COPYONLY)
+
+run_archiver_rejected("${WORK_DIR}/in" -a "${WORK_DIR}/test.huf" missing.txt)
+expect_same_file("${WORK_DIR}/appended.huf" "${WORK_DIR}/test.huf")
+
+# What the failed append must leave behind: the same archive as appending before_failure.txt alone.
+configure_file("${WORK_DIR}/test.huf" "${WORK_DIR}/expected.huf" COPYONLY)
+run_archiver("${WORK_DIR}/in" -a "${WORK_DIR}/expected.huf" before_failure.txt)
+run_archiver_rejected("${WORK_DIR}/in" -a "${WORK_DIR}/test.huf" before_failure.txt directory)
+expect_same_file("${WORK_DIR}/expected.huf" "${WORK_DIR}/test.huf")
+execute_process(COMMAND "${ARCHIVER}" -l "${WORK_DIR}/test.huf" OUTPUT_VARIABLE listing RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "archiver -l failed after a failed append: ${result}")
+endif()
+foreach(name ${files})
+    string(FIND "${listing}" "${name}" position)
+    if(position EQUAL -1)
+        message(FATAL_ERROR "${name} is missing from the archive:\n${listing}")
+    endif()
+endforeach()
+string(FIND "${listing}" "directory" position)
+if(NOT position EQUAL -1)
+    message(FATAL_ERROR "the failed input was listed:\n${listing}")
+endif()
+
+run_archiver("${WORK_DIR}/out" -d "${WORK_DIR}/test.huf")
+foreach(name ${files})
+    expect_same_file("${WORK_DIR}/in/${name}" "${WORK_DIR}/out/${name}")
+endforeach()
@@ -0,0 +1,138 @@
+#include <exception>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "coder.h"
+
+// Damaged version 2 archives: every truncation before the index must be reported as an error by the
+// stream decoder and by the index reader, and archives with a flipped byte must either decode or be
+// reported, never crash or allocate without bound. Archives are built in memory from generated members
+// that use stored, single-stream, interleaved and context-model blocks.
+namespace {
+    // Offsets tried for truncation and corruption: all of the first and last bytes of an archive, which
+    // hold the header, the first records and the index, and every OFFSET_STEP-th byte in between.
+    const size_t HEAD_SIZE = 128;
+    const size_t TAIL_SIZE = 128;
+    const size_t OFFSET_STEP = 29;
+
+    struct Member {
+        std::string name;
+        std::string data;
+    };
+
+    void Check(bool condition, const std::string& message) {
+        if (!condition) {
+            throw std::runtime_error(message);
+        }
+    }
+
+    std::vector<Member> MakeMembers() {
+        std::mt19937 random(20240601);
+        std::vector<Member> members = { { "text.txt", "" }, { "small.txt", "a short member\n" }, { "random.bin", "" },
+            { "empty.bin", "" } };
+        const std::string words[] = { "the ", "archive ", "block ", "code ", "table ", "of ", "a ", "huffman\n" };
+        while (members[0].data.size() < (1 << 15)) {
+            members[0].data += words[random() % 8];
+        }
+        for (size_t i = 0; i < 2000; ++i) {
+            members[2].data += static_cast<char>(random());
+        }
+        return members;
+    }
+
+    std::string MakeArchive(const std::vector<Member>& members, const Huffman::BlockOptions& options) {
+        std::ostringstream out;
+        {
+            Huffman::Encoder encoder(out, 1, options);
+            for (const auto& member : members) {
+                std::istringstream in(member.data);
+                encoder.EncodeStream(in, member.name);
+            }
+        }
+        return out.str();
+    }
+
+    // Returns whether the archive decoded; errors other than a reported malformed archive propagate.
+    bool DecodeStream(const std::string& archive, std::string& contents) {
+        try {
+            std::istringstream in(archive);
+            std::ostringstream out;
+            Huffman::Decoder decoder(in);
+            decoder.DecodeStream(out);
+            contents = out.str();
+            return true;
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+    }
+
+    bool ListFiles(const std::string& archive) {
+        try {
+            std::istringstream in(archive);
+            Huffman::Decoder decoder(in);
+            decoder.ListFiles();
+            return true;
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+    }
+
+    std::vector<size_t> Offsets(size_t size) {
+        std::vector<size_t> offsets;
+        for (size_t offset = 0; offset + TAIL_SIZE < size; offset += offset < HEAD_SIZE ? 1 : OFFSET_STEP) {
+            offsets.push_back(offset);
+        }
+        for (size_t offset = size > TAIL_SIZE ? size - TAIL_SIZE : 0; offset < size; ++offset) {
+            offsets.push_back(offset);
+        }
+        return offsets;
+    }
+
+    void CheckArchive(const std::string& archive, const std::string& expected) {
+        std::string contents;
+        Check(DecodeStream(archive, contents) && contents == expected, "the intact archive does not decode");
+        Check(ListFiles(archive), "the intact archive cannot be listed");
+        // The stream decoder stops at the index record, so only cuts before it must fail.
+        uint64_t index_offset = 0;
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+            index_offset |= static_cast<uint64_t>(static_cast<unsigned char>(archive[archive.size() - Huffman::TRAILER_SIZE + i])) << (8 * i);
+        }
+        for (size_t size : Offsets(archive.size())) {
+            std::string truncated = archive.substr(0, size);
+            Check(size > index_offset ? !DecodeStream(truncated, contents) || contents == expected : !DecodeStream(truncated, contents),
+                "an archive cut to " + std::to_string(size) + " bytes was decoded");
+            Check(!ListFiles(truncated), "an archive cut to " + std::to_string(size) + " bytes was listed");
+        }
+        for (size_t offset : Offsets(archive.size())) {
+            std::string corrupted = archive;
+            corrupted[offset] = static_cast<char>(corrupted[offset] ^ 0xFF);
+            DecodeStream(corrupted, contents);
+            ListFiles(corrupted);
+        }
+    }
+}
+
+int main() {
+    try {
+        std::vector<Member> members = MakeMembers();
+        std::string expected;
+        for (const auto& member : members) {
+            expected += member.data;
+        }
+        Huffman::BlockOptions single_stream;
+        single_stream.interleave = false;
+        Huffman::BlockOptions context_model;
+        context_model.context_model = true;
+        for (const auto& options : { Huffman::BlockOptions(), single_stream, context_model }) {
+            CheckArchive(MakeArchive(members, options), expected);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error!" << std::endl << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
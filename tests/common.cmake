@@ -0,0 +1,26 @@
+# Helpers shared by the test scripts; ARCHIVER is the archiver under test.
+
+# Runs ARCHIVER with the remaining arguments in directory and fails the test unless it succeeds.
+function(run_archiver directory)
+    execute_process(COMMAND "${ARCHIVER}" ${ARGN}
+        WORKING_DIRECTORY "${directory}" RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "archiver ${ARGN} failed: ${result}")
+    endif()
+endfunction()
+
+# Runs ARCHIVER like run_archiver and fails the test unless it reports an error; a crash is no such report.
+function(run_archiver_rejected directory)
+    execute_process(COMMAND "${ARCHIVER}" ${ARGN}
+        WORKING_DIRECTORY "${directory}" RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+    if(NOT result EQUAL 1)
+        message(FATAL_ERROR "archiver ${ARGN} did not report an error: ${result}")
+    endif()
+endfunction()
+
+function(expect_same_file expected actual)
+    execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${expected}" "${actual}" RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${actual} differs from ${expected}")
+    endif()
+endfunction()
@@ -0,0 +1,149 @@
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "archiveformat.h"
+#include "compress.h"
+
+// Checks of the buffer-to-buffer interface: round trips with the options that select each block type,
+// frames within CompressBound, and errors for too small outputs and truncated frames.
+namespace {
+    const unsigned char GUARD_BYTE = 0xA5;
+    const size_t GUARD_SIZE = 64;
+
+    struct Input {
+        std::string name;
+        std::vector<unsigned char> data;
+    };
+
+    struct Options {
+        std::string name;
+        Huffman::BlockOptions options;
+    };
+
+    void Check(bool condition, const std::string& message) {
+        if (!condition) {
+            throw std::runtime_error(message);
+        }
+    }
+
+    std::vector<Input> MakeInputs() {
+        std::mt19937 random(20240601);
+        std::vector<Input> inputs;
+        inputs.push_back({ "empty", {} });
+        inputs.push_back({ "one_byte", { 'x' } });
+        Input text = { "text", {} };
+        const std::string words[] = { "the ", "archive ", "block ", "code ", "table ", "of ", "a ", "huffman\n" };
+        while (text.data.size() < (1 << 18)) {
+            const std::string& word = words[random() % 8];
+            text.data.insert(text.data.end(), word.begin(), word.end());
+        }
+        inputs.push_back(text);
+        // Several blocks, the last one short.
+        Input skewed = { "skewed", std::vector<unsigned char>(Huffman::BLOCK_SIZE * 2 + 12345) };
+        std::geometric_distribution<int> geometric(0.2);
+        for (auto& byte : skewed.data) {
+            byte = static_cast<unsigned char>(geometric(random));
+        }
+        inputs.push_back(skewed);
+        Input noise = { "random", std::vector<unsigned char>(Huffman::BLOCK_SIZE + 1000) };
+        for (auto& byte : noise.data) {
+            byte = static_cast<unsigned char>(random());
+        }
+        inputs.push_back(noise);
+        return inputs;
+    }
+
+    std::vector<Options> MakeOptions() {
+        std::vector<Options> options(7);
+        options[0].name = "default";
+        options[1].name = "single_stream";
+        options[1].options.interleave = false;
+        options[2].name = "max_code_length";
+        options[2].options.max_code_length = 9;
+        options[3].name = "sample";
+        options[3].options.sample = true;
+        options[4].name = "preset";
+        options[4].options.preset = Huffman::Preset::TEXT;
+        options[5].name = "preset_auto";
+        options[5].options.preset = Huffman::Preset::AUTO;
+        options[6].name = "context_model";
+        options[6].options.context_model = true;
+        return options;
+    }
+
+    Huffman::ByteSpan Span(const std::vector<unsigned char>& data, size_t size) {
+        return { data.data(), size };
+    }
+
+    // Compresses into exactly CompressBound bytes followed by guard bytes that must stay untouched.
+    std::vector<unsigned char> CompressWithinBound(const std::vector<unsigned char>& data, const Huffman::BlockOptions& options) {
+        size_t bound = Huffman::CompressBound(data.size());
+        std::vector<unsigned char> output(bound + GUARD_SIZE, GUARD_BYTE);
+        Huffman::ByteSpan frame = Huffman::Compress(Span(data, data.size()), { output.data(), bound }, options);
+        Check(frame.data == output.data() && frame.size <= bound, "frame exceeds CompressBound");
+        for (size_t i = bound; i < output.size(); ++i) {
+            Check(output[i] == GUARD_BYTE, "Compress wrote past its output");
+        }
+        output.resize(frame.size);
+        return output;
+    }
+
+    void CheckRoundTrip(const std::vector<unsigned char>& data, const std::vector<unsigned char>& frame) {
+        Check(Huffman::DecompressedSize(Span(frame, frame.size())) == data.size(), "wrong decompressed size");
+        std::vector<unsigned char> output(data.size());
+        Huffman::ByteSpan result = Huffman::Decompress(Span(frame, frame.size()), { output.data(), output.size() });
+        Check(result.size == data.size() && output == data, "decompressed data differs");
+    }
+
+    template <typename Function>
+    void CheckThrows(Function function, const std::string& message) {
+        try {
+            function();
+        } catch (const std::runtime_error&) {
+            return;
+        }
+        throw std::runtime_error(message);
+    }
+
+    void CheckTooSmallOutput(const std::vector<unsigned char>& data, const std::vector<unsigned char>& frame,
+        const Huffman::BlockOptions& options) {
+        std::vector<unsigned char> output(frame.size());
+        CheckThrows([&]() { Huffman::Compress(Span(data, data.size()), { output.data(), frame.size() - 1 }, options); },
+            "no error for an output one byte short of the frame");
+        CheckThrows([&]() { Huffman::Compress(Span(data, data.size()), { output.data(), 0 }, options); },
+            "no error for an empty output");
+    }
+
+    void CheckTruncatedFrames(const std::vector<unsigned char>& data, const std::vector<unsigned char>& frame) {
+        std::vector<unsigned char> output(data.size());
+        for (size_t size : { frame.size() - 1, frame.size() / 2, size_t(2), size_t(1), size_t(0) }) {
+            CheckThrows([&]() { Huffman::Decompress(Span(frame, size), { output.data(), output.size() }); },
+                "no error for a frame cut to " + std::to_string(size) + " bytes");
+        }
+    }
+}
+
+int main() {
+    try {
+        std::vector<Input> inputs = MakeInputs();
+        for (const auto& options : MakeOptions()) {
+            for (const auto& input : inputs) {
+                std::cerr << options.name << " " << input.name << std::endl;
+                std::vector<unsigned char> frame = CompressWithinBound(input.data, options.options);
+                CheckRoundTrip(input.data, frame);
+                if (!input.data.empty()) {
+                    CheckTooSmallOutput(input.data, frame, options.options);
+                    CheckTruncatedFrames(input.data, frame);
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error!" << std::endl << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+# Archives a file, another one of the same size and a copy of the first with ARCHIVER -c --dedup, then
+# extracts them with -d, the copy alone with -x (its original is then decoded into it), and all of them
+# with -d - from a redirected file. From a pipe the archive cannot be read and must be rejected. Run as:
+#   cmake -DARCHIVER=... -DWORK_DIR=... -P dedup.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/common.cmake")
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/in" "${WORK_DIR}/all" "${WORK_DIR}/copy")
+
+string(REPEAT "the original and its copy\n" 2000 text)
+string(REPEAT "the original and its kopy\n" 2000 other)
+file(WRITE "${WORK_DIR}/in/original.txt" "${text}")
+file(WRITE "${WORK_DIR}/in/other.txt" "${other}")
+file(WRITE "${WORK_DIR}/in/copy.txt" "${text}")
+file(WRITE "${WORK_DIR}/stream_expected.txt" "${text}${other}${text}")
+set(files original.txt other.txt copy.txt)
+
+run_archiver("${WORK_DIR}/in" -c "${WORK_DIR}/plain.huf" ${files})
+run_archiver("${WORK_DIR}/in" -c --dedup "${WORK_DIR}/dedup.huf" ${files})
+file(SIZE "${WORK_DIR}/plain.huf" plain_size)
+file(SIZE "${WORK_DIR}/dedup.huf" dedup_size)
+if(NOT dedup_size LESS plain_size)
+    message(FATAL_ERROR "--dedup did not store copy.txt as a reference")
+endif()
+
+run_archiver("${WORK_DIR}/all" -d "${WORK_DIR}/dedup.huf")
+foreach(name ${files})
+    expect_same_file("${WORK_DIR}/in/${name}" "${WORK_DIR}/all/${name}")
+endforeach()
+
+run_archiver("${WORK_DIR}/copy" -x "${WORK_DIR}/dedup.huf" copy.txt)
+expect_same_file("${WORK_DIR}/in/copy.txt" "${WORK_DIR}/copy/copy.txt")
+if(EXISTS "${WORK_DIR}/copy/original.txt")
+    message(FATAL_ERROR "-x copy.txt also extracted original.txt")
+endif()
+
+execute_process(COMMAND "${ARCHIVER}" -d -
+    INPUT_FILE "${WORK_DIR}/dedup.huf" OUTPUT_FILE "${WORK_DIR}/stream.txt" RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "archiver -d - from a redirected file failed: ${result}")
+endif()
+expect_same_file("${WORK_DIR}/stream_expected.txt" "${WORK_DIR}/stream.txt")
+
+execute_process(COMMAND "${ARCHIVER}" -c --dedup - ${files} COMMAND "${ARCHIVER}" -d -
+    WORKING_DIRECTORY "${WORK_DIR}/in" RESULTS_VARIABLE results OUTPUT_QUIET ERROR_QUIET)
+if(NOT results STREQUAL "0;1")
+    message(FATAL_ERROR "archiver -d - read duplicates from a pipe: ${results}")
+endif()
@@ -0,0 +1,57 @@
+# Lists archives with ARCHIVER -l and extracts single members with -x, which seeks to them through the
+# index: from a plain archive and from a --solid one, whose members need the shared code table. A name
+# that is not in the archive is rejected. Also lists DATA_DIR/legacy.huf, a version 1 archive. Run as:
+#   cmake -DARCHIVER=... -DDATA_DIR=... -DWORK_DIR=... -P extract.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/common.cmake")
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/in")
+
+# The middle member spans two blocks.
+string(REPEAT "the first member of the archive\n" 1000 first)
+string(REPEAT "a member of more than one block, 0123456789\n" 30000 middle)
+string(REPEAT "the last member of the archive\n" 1000 last)
+file(WRITE "${WORK_DIR}/in/first.txt" "${first}")
+file(WRITE "${WORK_DIR}/in/middle.txt" "${middle}")
+file(WRITE "${WORK_DIR}/in/last.txt" "${last}")
+set(files first.txt middle.txt last.txt)
+
+set(expected_listing "")
+foreach(name ${files})
+    file(SIZE "${WORK_DIR}/in/${name}" size)
+    string(APPEND expected_listing "${size}\t${name}\n")
+endforeach()
+
+foreach(mode plain solid)
+    set(options "")
+    if(mode STREQUAL "solid")
+        set(options --solid)
+    endif()
+    set(archive "${WORK_DIR}/${mode}.huf")
+    run_archiver("${WORK_DIR}/in" -c ${options} "${archive}" ${files})
+
+    execute_process(COMMAND "${ARCHIVER}" -l "${archive}" OUTPUT_VARIABLE listing RESULT_VARIABLE result)
+    if(NOT result EQUAL 0 OR NOT listing STREQUAL expected_listing)
+        message(FATAL_ERROR "archiver -l of the ${mode} archive printed:\n${listing}")
+    endif()
+
+    foreach(name ${files})
+        file(MAKE_DIRECTORY "${WORK_DIR}/${mode}_${name}")
+        run_archiver("${WORK_DIR}/${mode}_${name}" -x "${archive}" ${name})
+        expect_same_file("${WORK_DIR}/in/${name}" "${WORK_DIR}/${mode}_${name}/${name}")
+        file(GLOB extracted RELATIVE "${WORK_DIR}/${mode}_${name}" "${WORK_DIR}/${mode}_${name}/*")
+        if(NOT extracted STREQUAL name)
+            message(FATAL_ERROR "archiver -x ${name} of the ${mode} archive extracted: ${extracted}")
+        endif()
+    endforeach()
+    run_archiver_rejected("${WORK_DIR}" -x "${archive}" missing.txt)
+endforeach()
+
+execute_process(COMMAND "${ARCHIVER}" -l "${DATA_DIR}/legacy.huf" OUTPUT_VARIABLE listing RESULT_VARIABLE result)
+foreach(name hello.txt bytes.bin empty.bin)
+    file(SIZE "${DATA_DIR}/${name}" size)
+    string(FIND "${listing}" "${size}\t${name}\n" position)
+    if(NOT result EQUAL 0 OR position EQUAL -1)
+        message(FATAL_ERROR "archiver -l of the version 1 archive printed:\n${listing}")
+    endif()
+endforeach()
@@ -0,0 +1,19 @@
+# Extracts DATA_DIR/legacy.huf, an archive written by the version 1 archiver, with ARCHIVER -d and
+# compares the members with their originals in DATA_DIR. Run as:
+#   cmake -DARCHIVER=... -DDATA_DIR=... -DWORK_DIR=... -P legacy.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+execute_process(COMMAND "${ARCHIVER}" -d "${DATA_DIR}/legacy.huf"
+    WORKING_DIRECTORY "${WORK_DIR}" RESULT_VARIABLE result OUTPUT_QUIET)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "archiver -d failed: ${result}")
+endif()
+
+foreach(name hello.txt bytes.bin empty.bin)
+    execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${DATA_DIR}/${name}" "${WORK_DIR}/${name}"
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${name} differs after extracting the version 1 archive")
+    endif()
+endforeach()
@@ -0,0 +1,45 @@
+# Archives a set of files with ARCHIVER -c OPTIONS, extracts them with -d into a fresh directory and
+# compares every file byte for byte. Run as:
+#   cmake -DARCHIVER=... -DDATA_DIR=... -DSOURCE_DIR=... -DWORK_DIR=... "-DOPTIONS=..." -P roundtrip.cmake
+# Besides the small files of DATA_DIR, the inputs are a text of several blocks made of the sources in
+# SOURCE_DIR, the archiver binary itself, and a copy of the text, so that every block type gets used.
+
+separate_arguments(OPTIONS)
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/in" "${WORK_DIR}/out")
+
+file(GLOB sources "${SOURCE_DIR}/*.cpp" "${SOURCE_DIR}/*.h")
+list(SORT sources)
+set(text "")
+foreach(round RANGE 7)
+    foreach(source ${sources})
+        file(READ "${source}" content)
+        string(APPEND text "${content}")
+    endforeach()
+endforeach()
+file(WRITE "${WORK_DIR}/in/text.txt" "${text}")
+file(WRITE "${WORK_DIR}/in/text_copy.txt" "${text}")
+configure_file("${ARCHIVER}" "${WORK_DIR}/in/binary.bin" COPYONLY)
+foreach(name hello.txt bytes.bin empty.bin)
+    configure_file("${DATA_DIR}/${name}" "${WORK_DIR}/in/${name}" COPYONLY)
+endforeach()
+set(files text.txt binary.bin hello.txt bytes.bin empty.bin text_copy.txt)
+
+execute_process(COMMAND "${ARCHIVER}" -c ${OPTIONS} "${WORK_DIR}/test.huf" ${files}
+    WORKING_DIRECTORY "${WORK_DIR}/in" RESULT_VARIABLE result OUTPUT_QUIET)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "archiver -c ${OPTIONS} failed: ${result}")
+endif()
+execute_process(COMMAND "${ARCHIVER}" -d "${WORK_DIR}/test.huf"
+    WORKING_DIRECTORY "${WORK_DIR}/out" RESULT_VARIABLE result OUTPUT_QUIET)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "archiver -d failed: ${result}")
+endif()
+
+foreach(name ${files})
+    execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${WORK_DIR}/in/${name}" "${WORK_DIR}/out/${name}"
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${name} differs after the round trip with options '${OPTIONS}'")
+    endif()
+endforeach()
@@ -0,0 +1,35 @@
+# Streams through pipes: standard input archived with ARCHIVER -c - into -d -, and files archived to
+# standard output into -d - on four threads, which prints the files one after another. The input of
+# several blocks is generated from the sources in SOURCE_DIR. Run as:
+#   cmake -DARCHIVER=... -DSOURCE_DIR=... -DWORK_DIR=... -P stream.cmake
+
+include("${CMAKE_CURRENT_LIST_DIR}/common.cmake")
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/in")
+
+file(GLOB sources "${SOURCE_DIR}/*.cpp" "${SOURCE_DIR}/*.h")
+list(SORT sources)
+set(text "")
+foreach(round RANGE 7)
+    foreach(source ${sources})
+        file(READ "${source}" content)
+        string(APPEND text "${content}")
+    endforeach()
+endforeach()
+file(WRITE "${WORK_DIR}/in/text.txt" "${text}")
+file(WRITE "${WORK_DIR}/in/small.txt" "a small file between two large ones\n")
+file(WRITE "${WORK_DIR}/concatenated.txt" "${text}a small file between two large ones\n${text}")
+
+execute_process(COMMAND "${ARCHIVER}" -c - COMMAND "${ARCHIVER}" -d -
+    INPUT_FILE "${WORK_DIR}/in/text.txt" OUTPUT_FILE "${WORK_DIR}/stdin.txt" RESULTS_VARIABLE results ERROR_QUIET)
+if(NOT results STREQUAL "0;0")
+    message(FATAL_ERROR "archiver -c - | archiver -d - failed: ${results}")
+endif()
+expect_same_file("${WORK_DIR}/in/text.txt" "${WORK_DIR}/stdin.txt")
+
+execute_process(COMMAND "${ARCHIVER}" -c - text.txt small.txt text.txt COMMAND "${ARCHIVER}" -d -j 4 -
+    WORKING_DIRECTORY "${WORK_DIR}/in" OUTPUT_FILE "${WORK_DIR}/files.txt" RESULTS_VARIABLE results ERROR_QUIET)
+if(NOT results STREQUAL "0;0")
+    message(FATAL_ERROR "archiver -c - files | archiver -d -j 4 - failed: ${results}")
+endif()
+expect_same_file("${WORK_DIR}/concatenated.txt" "${WORK_DIR}/files.txt")
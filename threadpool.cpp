@@ -0,0 +1,42 @@
+#include "threadpool.h"
+
+namespace Huffman {
+    ThreadPool::ThreadPool(size_t thread_count) {
+        stopping_ = false;
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads_.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    size_t ThreadPool::DefaultThreadCount() {
+        size_t thread_count = std::thread::hardware_concurrency();
+        return thread_count > 0 ? thread_count : 1;
+    }
+
+    void ThreadPool::WorkerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+}
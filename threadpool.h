@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace Huffman {
+    // Fixed set of worker threads executing submitted tasks in FIFO order. Tasks still queued when the pool
+    // is destroyed are dropped; their futures report a broken promise.
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t thread_count);
+        ~ThreadPool();
+
+        template <class Function>
+        auto Submit(Function function) -> std::future<decltype(function())> {
+            using Result = decltype(function());
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+            std::future<Result> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasks_.push([task]() { (*task)(); });
+            }
+            condition_.notify_one();
+            return result;
+        }
+
+        static size_t DefaultThreadCount();
+
+    private:
+        std::vector<std::thread> threads_;
+        std::queue<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        bool stopping_;
+
+        void WorkerLoop();
+    };
+
+    // Runs function on pool, or right away on the calling thread when pool is nullptr.
+    template <class Function>
+    auto SubmitTo(ThreadPool* pool, Function function) -> std::future<decltype(function())> {
+        if (pool != nullptr) {
+            return pool->Submit(std::move(function));
+        }
+        std::packaged_task<decltype(function())()> task(std::move(function));
+        std::future<decltype(function())> result = task.get_future();
+        task();
+        return result;
+    }
+}